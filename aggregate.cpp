@@ -0,0 +1,59 @@
+#include "aggregate.h"
+#include "journal.h"
+
+CrossingAggregator::CrossingAggregator(uint16_t bucketWidth)
+    : journal(NULL), hasCurrent(false), bucketWidth(bucketWidth > 0 ? bucketWidth : 1), occupancy(0)
+{
+}
+
+void CrossingAggregator::setBucketWidth(uint16_t bucketWidth)
+{
+    closeCurrent();
+    this->bucketWidth = bucketWidth > 0 ? bucketWidth : 1;
+}
+
+void CrossingAggregator::closeCurrent()
+{
+    if(!hasCurrent)
+        return;
+    if(journal)
+        journal->add(buckets, current);
+    else
+        buckets.push(current);
+    hasCurrent = false;
+}
+
+void CrossingAggregator::closeBefore(uint32_t time)
+{
+    if(hasCurrent && time - current.startTime >= current.width)
+        closeCurrent();
+}
+
+void CrossingAggregator::add(EventDirection direction, uint32_t time)
+{
+    closeBefore(time);
+    if(!hasCurrent)
+    {
+        current.startTime = time - time % bucketWidth;
+        current.occupancy = occupancy;
+        current.inCount = 0;
+        current.outCount = 0;
+        current.width = bucketWidth;
+        current.flags = 0;
+        hasCurrent = true;
+    }
+    if(direction == EventIn)
+    {
+        occupancy++;
+        if(current.inCount < 0xFFFF)
+            current.inCount++;
+    }
+    else
+    {
+        if(occupancy > 0) // a missed "in" shouldn't leave it negative for the rest of the day
+            occupancy--;
+        if(current.outCount < 0xFFFF)
+            current.outCount++;
+    }
+    current.occupancy = occupancy;
+}
@@ -0,0 +1,65 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "eventlog.h"
+
+class EventJournal;
+
+/** the crossings in one bucket of time, for sending counts instead of every event */
+struct CountBucket
+{
+    uint32_t startTime; // a multiple of width
+    int32_t occupancy; // people inside at the end of the bucket
+    uint16_t inCount, outCount; // stop at 65535
+    uint16_t width; // seconds
+    uint16_t flags; // EventFlag bits
+};
+
+/** counts crossings into fixed width buckets of time and keeps a running occupancy.
+  * A bucket is closed, and waits in getBuckets() to be sent, once an event or
+  * closeBefore() comes after its end. Buckets with no crossings aren't kept, so the
+  * number waiting only depends on the time since the last send, not on the traffic.
+  */
+class CrossingAggregator
+{
+public:
+    enum {ClosedBucketCapacity = 64}; // an hour of one minute buckets
+    typedef EventRing<ClosedBucketCapacity, CountBucket> BucketRing;
+private:
+    BucketRing buckets;
+    EventJournal * journal; // closed buckets go through it when set
+    CountBucket current;
+    bool hasCurrent;
+    uint16_t bucketWidth;
+    int32_t occupancy;
+    void closeCurrent();
+    CrossingAggregator(const CrossingAggregator &);
+    const CrossingAggregator & operator =(const CrossingAggregator &);
+public:
+    explicit CrossingAggregator(uint16_t bucketWidth = 60);
+    void setBucketWidth(uint16_t bucketWidth); // closes the current bucket
+    uint16_t getBucketWidth() const
+    {
+        return bucketWidth;
+    }
+    int32_t getOccupancy() const
+    {
+        return occupancy;
+    }
+    void setOccupancy(int32_t occupancy) // at boot, from the last bucket journaled
+    {
+        this->occupancy = occupancy;
+    }
+    void setJournal(EventJournal * journal) // so buckets that don't fit in the ring wait on /local
+    {
+        this->journal = journal;
+    }
+    void add(EventDirection direction, uint32_t time);
+    void closeBefore(uint32_t time); // closes the current bucket if it ends by time
+    BucketRing & getBuckets()
+    {
+        return buckets;
+    }
+};
+
+#endif
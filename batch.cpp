@@ -0,0 +1,116 @@
+#include "batch.h"
+#include "payload.h"
+#include <sstream>
+
+void appendVarint(string & dest, uint32_t value)
+{
+    while(value >= 0x80)
+    {
+        dest += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    dest += (char)value;
+}
+
+bool parseVarint(const string & src, size_t & offset, uint32_t & value)
+{
+    value = 0;
+    for(unsigned shift = 0; shift < 35; shift += 7)
+    {
+        if(offset >= src.size())
+            return false;
+        uint8_t byte = (uint8_t)src[offset++];
+        if(shift == 28 && (byte & 0x70) != 0)
+            return false;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool parseSmallVarint(const string & src, size_t & offset, uint16_t & value)
+{
+    uint32_t v;
+    if(!parseVarint(src, offset, v) || v > 0xFFFF)
+        return false;
+    value = (uint16_t)v;
+    return true;
+}
+
+static bool decodeBinaryBatch(const string & src, size_t offset, DecodedBatch & batch)
+{
+    if(offset >= src.size() || (uint8_t)src[offset++] != BinaryBatchVersion)
+        return false;
+    uint32_t count;
+    if(!parseVarint(src, offset, batch.time) || !parseVarint(src, offset, batch.droppedEvents)
+       || !parseVarint(src, offset, batch.droppedBuckets) || !parseVarint(src, offset, count) || count > src.size() - offset)
+        return false;
+    batch.events.resize(count);
+    uint32_t previousTime = batch.time;
+    for(size_t i = 0; i < count; i++)
+    {
+        uint32_t value;
+        if(!parseVarint(src, offset, value))
+            return false;
+        EventRecord & event = batch.events[i];
+        event.time = previousTime + (uint32_t)zigzagDecode(value >> 2);
+        event.direction = (value & 1) ? EventOut : EventIn;
+        event.sensorPair = 0;
+        event.flags = (value & 2) ? EventAfterGap : 0;
+        previousTime = event.time;
+    }
+    if(!parseVarint(src, offset, count) || count > src.size() - offset)
+        return false;
+    batch.buckets.resize(count);
+    previousTime = batch.time;
+    for(size_t i = 0; i < count; i++)
+    {
+        CountBucket & bucket = batch.buckets[i];
+        uint32_t startDelta, occupancy;
+        if(!parseVarint(src, offset, startDelta) || !parseSmallVarint(src, offset, bucket.width)
+           || !parseSmallVarint(src, offset, bucket.inCount) || !parseSmallVarint(src, offset, bucket.outCount)
+           || !parseVarint(src, offset, occupancy))
+            return false;
+        bucket.startTime = previousTime + (uint32_t)zigzagDecode(startDelta >> 1);
+        bucket.occupancy = zigzagDecode(occupancy);
+        bucket.flags = (startDelta & 1) ? EventAfterGap : 0;
+        previousTime = bucket.startTime;
+    }
+    return offset == src.size();
+}
+
+bool decodeBatch(const string & src, size_t offset, DecodedBatch & batch)
+{
+    if(offset >= src.size() || src[offset] != Base64BatchMarker)
+        return decodeBinaryBatch(src, offset, batch);
+    size_t end = src.size();
+    if(src[end - 1] == '\n')
+        end--;
+    vector<uint8_t> bytes;
+    if(!parseBase64Bytes(src.substr(offset + 1, end - offset - 1), bytes) || bytes.empty())
+        return false;
+    return decodeBinaryBatch(string(bytes.begin(), bytes.end()), 0, batch);
+}
+
+void appendTextBatch(string & dest, const DecodedBatch & batch)
+{
+    ostringstream os;
+    os << hex << (time_t)batch.time;
+    if(batch.droppedEvents > 0 || batch.droppedBuckets > 0)
+        os << " " << batch.droppedEvents << " " << batch.droppedBuckets;
+    os << "\n";
+    for(size_t i = 0; i < batch.events.size(); i++)
+    {
+        const EventRecord & event = batch.events[i];
+        os << (time_t)event.time << (event.direction == EventIn ? " in" : " out")
+           << ((event.flags & EventAfterGap) ? " gap\n" : "\n");
+    }
+    for(size_t i = 0; i < batch.buckets.size(); i++)
+    {
+        const CountBucket & bucket = batch.buckets[i];
+        os << (time_t)bucket.startTime << " counts " << bucket.width << " " << bucket.inCount << " "
+           << bucket.outCount << " " << bucket.occupancy << ((bucket.flags & EventAfterGap) ? " gap\n" : "\n");
+    }
+    dest += os.str();
+}
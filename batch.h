@@ -0,0 +1,96 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "eventlog.h"
+#include "aggregate.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** how sendEvents writes a batch, after the device name line.
+  *   TextBatch : the hex lines, see sendEvents in main.cpp.
+  *   BinaryBatch : BinaryBatchVersion, then varints (7 bits a byte, low bits first) :
+  *       the batch time
+  *       the events and the buckets dropped since boot because their ring was full
+  *       the event count, then per event ((zigzag(time - previous time) << 2) | (gap << 1) | direction),
+  *           where the previous time starts at the batch time and gap is 1 if records were
+  *           dropped just before it
+  *       the bucket count, then per bucket ((zigzag(start time - previous start time) << 1) | gap),
+  *           width, in count, out count and zigzag(occupancy)
+  *     Events a second or so apart take one byte each instead of a dozen.
+  *   Base64Batch : Base64BatchMarker, then the binary batch in base64 and a newline, for
+  *     collectors that want text.
+  */
+enum BatchFormat
+{
+    TextBatch,
+    BinaryBatch,
+    Base64Batch
+};
+
+const uint8_t BinaryBatchVersion = 1;
+const char Base64BatchMarker = '*';
+
+/** a batch as the collector gets it back */
+struct DecodedBatch
+{
+    uint32_t time;
+    uint32_t droppedEvents, droppedBuckets; // since boot
+    vector<EventRecord> events;
+    vector<CountBucket> buckets;
+};
+
+void appendVarint(string & dest, uint32_t value);
+bool parseVarint(const string & src, size_t & offset, uint32_t & value); // false if it runs off the end or past 32 bits
+
+inline uint32_t zigzagEncode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t zigzagDecode(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/** writes the first eventCount events and bucketCount buckets as a BinaryBatch */
+template <size_t EventCapacity, size_t BucketCapacity>
+void appendBinaryBatch(string & dest, uint32_t time, const EventRing<EventCapacity> & events, size_t eventCount,
+                       const EventRing<BucketCapacity, CountBucket> & buckets, size_t bucketCount)
+{
+    dest.reserve(dest.size() + 14 + eventCount * 2 + bucketCount * 10);
+    dest += (char)BinaryBatchVersion;
+    appendVarint(dest, time);
+    appendVarint(dest, events.getDroppedCount());
+    appendVarint(dest, buckets.getDroppedCount());
+    appendVarint(dest, (uint32_t)eventCount);
+    uint32_t previousTime = time;
+    for(size_t i = 0; i < eventCount; i++)
+    {
+        const EventRecord & event = events[i];
+        appendVarint(dest, (zigzagEncode((int32_t)(event.time - previousTime)) << 2) | ((event.flags & EventAfterGap) ? 2 : 0)
+                           | (event.direction == EventOut ? 1 : 0));
+        previousTime = event.time;
+    }
+    appendVarint(dest, (uint32_t)bucketCount);
+    previousTime = time;
+    for(size_t i = 0; i < bucketCount; i++)
+    {
+        const CountBucket & bucket = buckets[i];
+        appendVarint(dest, (zigzagEncode((int32_t)(bucket.startTime - previousTime)) << 1) | ((bucket.flags & EventAfterGap) ? 1 : 0));
+        appendVarint(dest, bucket.width);
+        appendVarint(dest, bucket.inCount);
+        appendVarint(dest, bucket.outCount);
+        appendVarint(dest, zigzagEncode(bucket.occupancy));
+        previousTime = bucket.startTime;
+    }
+}
+
+/** the collector's side : decodes a binary or base64 framed batch starting at offset in src.
+  * Returns false if it's malformed or a version it doesn't know.
+  */
+bool decodeBatch(const string & src, size_t offset, DecodedBatch & batch);
+void appendTextBatch(string & dest, const DecodedBatch & batch); // the same batch as TextBatch lines
+
+#endif
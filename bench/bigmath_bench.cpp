@@ -0,0 +1,625 @@
+// host benchmark for bigmath : make bench && ./bench/bigmath_bench
+#include "bigmath.h"
+#include "rsa.h"
+#include "payload.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+static BigUnsigned randomNumber(size_t bitCount)
+{
+    BigUnsigned retval(0);
+    for(size_t i = 0; i < bitCount; i += 16)
+    {
+        retval <<= 16;
+        retval += (WordType)(rand() & 0xFFFF);
+    }
+    return retval >> (retval == (WordType)0 ? 0 : (bitCount + 15) / 16 * 16 - bitCount);
+}
+
+static BigUnsigned randomModulus(size_t bitCount)
+{
+    BigUnsigned retval = randomNumber(bitCount - 1);
+    BigUnsigned topBit(1);
+    topBit <<= bitCount - 1;
+    retval |= topBit;
+    retval |= (WordType)1;
+    return retval;
+}
+
+// square and multiply with a full division after every step, the way powMod worked before MontgomeryContext
+static BigUnsigned divisionPowMod(BigUnsigned base, BigUnsigned exponent, BigUnsigned modulus)
+{
+    BigUnsigned retval(1);
+    base %= modulus;
+    while(exponent != (WordType)0)
+    {
+        if(((WordType)exponent & 1) != 0)
+            retval = (retval * base) % modulus;
+        exponent >>= 1;
+        if(exponent != (WordType)0)
+            base = (base * base) % modulus;
+    }
+    return retval;
+}
+
+template <typename Operation>
+static double microsecondsPerOperation(Operation operation, double minimumTime = 0.25)
+{
+    size_t count = 0;
+    clock_t start = clock();
+    double elapsed;
+    do
+    {
+        operation();
+        count++;
+    }
+    while((elapsed = (double)(clock() - start) / CLOCKS_PER_SEC) < minimumTime);
+    return 1e6 * elapsed / count;
+}
+
+struct DivisionPowModOperation
+{
+    BigUnsigned base, exponent, modulus;
+    void operator ()() const
+    {
+        divisionPowMod(base, exponent, modulus);
+    }
+};
+
+struct MontgomeryPowModOperation
+{
+    BigUnsigned base, exponent;
+    const MontgomeryContext * context;
+    void operator ()() const
+    {
+        powMod(base, exponent, *context);
+    }
+};
+
+struct MultiplyOperation
+{
+    BigUnsigned a, b;
+    void operator ()() const
+    {
+        a * b;
+    }
+};
+
+static void benchPowMod(size_t bitCount, BigUnsigned exponent, const char * exponentName)
+{
+    BigUnsigned modulus = randomModulus(bitCount);
+    BigUnsigned base = randomNumber(bitCount - 1);
+    MontgomeryContext context(modulus);
+    if(divisionPowMod(base, exponent, modulus) != powMod(base, exponent, context))
+    {
+        cout << "powMod mismatch for " << bitCount << " bit modulus" << endl;
+        exit(1);
+    }
+    DivisionPowModOperation division = {base, exponent, modulus};
+    MontgomeryPowModOperation montgomery = {base, exponent, &context};
+    double divisionMicroseconds = microsecondsPerOperation(division);
+    double montgomeryMicroseconds = microsecondsPerOperation(montgomery);
+    cout << setw(6) << bitCount << setw(10) << exponentName << fixed << setprecision(1)
+         << setw(14) << divisionMicroseconds << setw(14) << montgomeryMicroseconds
+         << setw(9) << setprecision(2) << divisionMicroseconds / montgomeryMicroseconds << "x" << endl;
+}
+
+// compare the schoolbook method with one level of Karatsuba on top of it, to find where splitting starts to pay off
+static void benchKaratsubaCrossover()
+{
+    const size_t savedThreshold = BigUnsigned::karatsubaThreshold;
+    const size_t wordCounts[] = {4, 6, 8, 10, 12, 16, 20, 24, 28, 32, 40, 48, 64, 96, 128};
+    size_t crossover = 0;
+    cout << "operator * : schoolbook vs one Karatsuba level (us/op)" << endl;
+    cout << " words    schoolbook     karatsuba" << endl;
+    for(size_t i = 0; i < sizeof(wordCounts) / sizeof(wordCounts[0]); i++)
+    {
+        size_t wordCount = wordCounts[i];
+        MultiplyOperation multiply = {randomModulus(wordCount * BitsPerWord), randomModulus(wordCount * BitsPerWord)};
+        BigUnsigned::karatsubaThreshold = wordCount + 1;
+        BigUnsigned expected = multiply.a * multiply.b;
+        double schoolbookMicroseconds = microsecondsPerOperation(multiply, 0.1);
+        BigUnsigned::karatsubaThreshold = wordCount;
+        if(multiply.a * multiply.b != expected)
+        {
+            cout << "Karatsuba mismatch for " << wordCount << " words" << endl;
+            exit(1);
+        }
+        double karatsubaMicroseconds = microsecondsPerOperation(multiply, 0.1);
+        if(karatsubaMicroseconds >= schoolbookMicroseconds)
+            crossover = 0;
+        else if(crossover == 0)
+            crossover = wordCount;
+        cout << setw(6) << wordCount << fixed << setprecision(3)
+             << setw(14) << schoolbookMicroseconds << setw(14) << karatsubaMicroseconds << endl;
+    }
+    BigUnsigned::karatsubaThreshold = savedThreshold;
+    if(crossover == 0)
+        cout << "no crossover found" << endl;
+    else
+        cout << "crossover at " << crossover << " words (karatsubaThreshold is " << savedThreshold << ")" << endl;
+}
+
+// one digit at a time with shifts of the whole number, the way toBase64 and parseBase64 worked before they walked the words
+static const char Base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static string shiftingToBase64(BigUnsigned v)
+{
+    string retval;
+    do
+    {
+        retval.push_back(Base64Digits[(WordType)(v & (WordType)0x3F)]);
+        v >>= 6;
+    }
+    while(v != (WordType)0);
+    reverse(retval.begin(), retval.end());
+    return retval;
+}
+
+static BigUnsigned shiftingParseBase64(const string & str)
+{
+    BigUnsigned retval(0);
+    for(size_t i = 0; i < str.size(); i++)
+    {
+        retval <<= 6;
+        retval |= (WordType)(strchr(Base64Digits, str[i]) - Base64Digits);
+    }
+    return retval;
+}
+
+struct ToBase64Operation
+{
+    BigUnsigned v;
+    bool shifting;
+    void operator ()() const
+    {
+        if(shifting)
+            shiftingToBase64(v);
+        else
+            v.toBase64();
+    }
+};
+
+struct ParseBase64Operation
+{
+    string str;
+    bool shifting;
+    void operator ()() const
+    {
+        if(shifting)
+            shiftingParseBase64(str);
+        else
+            BigUnsigned::parseBase64(str);
+    }
+};
+
+static void benchBase64()
+{
+    cout << "base64 : digit at a time vs 24 bit groups (MB/s of base64 text)" << endl;
+    cout << "  bits  encode old    encode new  decode old    decode new" << endl;
+    const size_t bitCounts[] = {256, 2048, 4096, 16384, 65536};
+    for(size_t i = 0; i < sizeof(bitCounts) / sizeof(bitCounts[0]); i++)
+    {
+        BigUnsigned v = randomModulus(bitCounts[i]);
+        string str = v.toBase64();
+        if(str != shiftingToBase64(v) || BigUnsigned::parseBase64(str) != v || shiftingParseBase64(str) != v)
+        {
+            cout << "base64 mismatch for " << bitCounts[i] << " bits" << endl;
+            exit(1);
+        }
+        double megabytes = str.size() / 1e6;
+        ToBase64Operation encodeOld = {v, true}, encodeNew = {v, false};
+        ParseBase64Operation decodeOld = {str, true}, decodeNew = {str, false};
+        cout << setw(6) << bitCounts[i] << fixed << setprecision(2)
+             << setw(12) << megabytes / microsecondsPerOperation(encodeOld, 0.1) * 1e6
+             << setw(14) << megabytes / microsecondsPerOperation(encodeNew, 0.1) * 1e6
+             << setw(12) << megabytes / microsecondsPerOperation(decodeOld, 0.1) * 1e6
+             << setw(14) << megabytes / microsecondsPerOperation(decodeNew, 0.1) * 1e6 << endl;
+    }
+}
+
+// a word sized block of digits at a time over the whole number, the way toString and parse worked before they split it in half
+static string blockToString(BigUnsigned v)
+{
+    const WordType blockPower = 1000000000;
+    string retval;
+    WordType currentBlock;
+    while(v >= blockPower)
+    {
+        divModInto(v, currentBlock, v, blockPower);
+        for(size_t i = 0; i < 9; i++, currentBlock /= 10)
+            retval.push_back((char)('0' + currentBlock % 10));
+    }
+    for(currentBlock = (WordType)v; currentBlock != 0; currentBlock /= 10)
+        retval.push_back((char)('0' + currentBlock % 10));
+    if(retval.empty())
+        retval = "0";
+    reverse(retval.begin(), retval.end());
+    return retval;
+}
+
+static BigUnsigned digitParse(const string & str)
+{
+    BigUnsigned retval(0);
+    for(size_t i = 0; i < str.size(); i++)
+        mulAdd(retval, retval, (WordType)10, (WordType)(str[i] - '0'));
+    return retval;
+}
+
+struct ToStringOperation
+{
+    BigUnsigned v;
+    bool block;
+    void operator ()() const
+    {
+        if(block)
+            blockToString(v);
+        else
+            v.toString(10);
+    }
+};
+
+struct ParseOperation
+{
+    string str;
+    bool digit;
+    void operator ()() const
+    {
+        if(digit)
+            digitParse(str);
+        else
+            BigUnsigned::parse(str, 10U);
+    }
+};
+
+static void benchDecimal()
+{
+    cout << "decimal : whole number loops vs splitting by powers of 10 (us/op)" << endl;
+    cout << "  bits  toString old  toString new  parse old     parse new" << endl;
+    const size_t bitCounts[] = {256, 2048, 4096, 16384, 65536};
+    for(size_t i = 0; i < sizeof(bitCounts) / sizeof(bitCounts[0]); i++)
+    {
+        BigUnsigned v = randomModulus(bitCounts[i]);
+        string str = v.toString(10);
+        if(str != blockToString(v) || BigUnsigned::parse(str, 10U) != v || digitParse(str) != v)
+        {
+            cout << "decimal mismatch for " << bitCounts[i] << " bits" << endl;
+            exit(1);
+        }
+        ToStringOperation toStringOld = {v, true}, toStringNew = {v, false};
+        ParseOperation parseOld = {str, true}, parseNew = {str, false};
+        cout << setw(6) << bitCounts[i] << fixed << setprecision(1)
+             << setw(14) << microsecondsPerOperation(toStringOld, 0.1)
+             << setw(14) << microsecondsPerOperation(toStringNew, 0.1)
+             << setw(14) << microsecondsPerOperation(parseOld, 0.1)
+             << setw(14) << microsecondsPerOperation(parseNew, 0.1) << endl;
+    }
+}
+
+// Euclid's algorithm with a full division per step, the way gcd worked before Lehmer's algorithm
+static BigUnsigned euclidGcd(BigUnsigned a, BigUnsigned b)
+{
+    if(a < b)
+        a.swap(b);
+    while(b != (WordType)0)
+    {
+        BigUnsigned c = a % b;
+        a.swap(b);
+        b.swap(c);
+    }
+    return a;
+}
+
+struct GcdOperation
+{
+    BigUnsigned a, b;
+    int kind; // 0 euclid, 1 lehmer, 2 extended, 3 inverse
+    void operator ()() const
+    {
+        BigUnsigned x, y;
+        switch(kind)
+        {
+        case 0:
+            euclidGcd(a, b);
+            break;
+        case 1:
+            gcd(a, b);
+            break;
+        case 2:
+            extendedGcd(a, b, x, y);
+            break;
+        default:
+            modInverse(a, b);
+            break;
+        }
+    }
+};
+
+static void benchGcd()
+{
+    cout << "gcd : Euclid vs Lehmer (us/op)" << endl;
+    cout << "  bits        euclid        lehmer   extendedGcd    modInverse" << endl;
+    const size_t bitCounts[] = {1024, 2048, 3072, 4096};
+    for(size_t i = 0; i < sizeof(bitCounts) / sizeof(bitCounts[0]); i++)
+    {
+        BigUnsigned a = randomModulus(bitCounts[i]), b = randomModulus(bitCounts[i]);
+        while(gcd(a, b) != (WordType)1)
+            a += (WordType)2;
+        BigUnsigned x, y;
+        extendedGcd(a, b, x, y);
+        if(euclidGcd(a, b) != (WordType)1 || a * x - b * y != (WordType)1 || (a * modInverse(a, b)) % b != (WordType)1)
+        {
+            cout << "gcd mismatch for " << bitCounts[i] << " bits" << endl;
+            exit(1);
+        }
+        GcdOperation euclid = {a, b, 0}, lehmer = {a, b, 1}, extended = {a, b, 2}, inverse = {a, b, 3};
+        cout << setw(6) << bitCounts[i] << fixed << setprecision(1)
+             << setw(14) << microsecondsPerOperation(euclid, 0.1)
+             << setw(14) << microsecondsPerOperation(lehmer, 0.1)
+             << setw(14) << microsecondsPerOperation(extended, 0.1)
+             << setw(14) << microsecondsPerOperation(inverse, 0.1) << endl;
+    }
+}
+
+// the chunk loop of encryptString() in main.cpp written three ways, to count the allocations each makes
+static const size_t EncryptChunkSize = 32;
+static const WordType CheckSumModulus = 8191;
+
+static void randomWords(WordType words[2])
+{
+    words[0] = (WordType)rand();
+    words[1] = (WordType)rand();
+}
+
+static string encryptWithOperators(const RSAPublicKey & key, const string & text)
+{
+    const WordBarrettReducer checkSumReducer(CheckSumModulus);
+    string retval = "1";
+    for(size_t i = 0; i < text.size(); i += EncryptChunkSize)
+    {
+        WordType random[2];
+        randomWords(random);
+        BigUnsigned v = BigUnsigned::fromByteString(text.substr(i, EncryptChunkSize));
+        v = (v << 2 * BitsPerWord) + ((BigUnsigned(random[1]) << BitsPerWord) + random[0]);
+        WordType checkSum = checkSumReducer.reduce(v);
+        v *= CheckSumModulus;
+        v += checkSum;
+        v = key.encrypt(v);
+        retval += v.toBase64() + "\n";
+    }
+    return retval;
+}
+
+static string encryptInPlace(const RSAPublicKey & key, const string & text)
+{
+    const WordBarrettReducer checkSumReducer(CheckSumModulus);
+    string retval = "1";
+    for(size_t i = 0; i < text.size(); i += EncryptChunkSize)
+    {
+        WordType random[2];
+        randomWords(random);
+        BigUnsigned v = BigUnsigned::fromByteString(text.substr(i, EncryptChunkSize));
+        shiftLeftInto(v, v, BitsPerWord);
+        v += random[1];
+        shiftLeftInto(v, v, BitsPerWord);
+        v += random[0];
+        WordType checkSum = checkSumReducer.reduce(v);
+        mulAdd(v, v, CheckSumModulus, checkSum);
+        v = key.encrypt(v);
+        retval += v.toBase64() + "\n";
+    }
+    return retval;
+}
+
+static string encryptFixed(const RSAPublicKey & key, const string & text)
+{
+    typedef FixedBigUnsigned<4096 / BitsPerWord> EncryptionBlock;
+    const WordBarrettReducer checkSumReducer(CheckSumModulus);
+    string retval = "1";
+    for(size_t i = 0; i < text.size(); i += EncryptChunkSize)
+    {
+        WordType random[2];
+        randomWords(random);
+        EncryptionBlock v = EncryptionBlock::fromByteString(text, i, EncryptChunkSize);
+        v <<= 2 * BitsPerWord;
+        v += EncryptionBlock::fromWords(random, 2);
+        WordType checkSum = checkSumReducer.reduce(v.getWords(), v.getWordCount());
+        v *= CheckSumModulus;
+        v += checkSum;
+        v = key.encrypt(v);
+        v.appendBase64(retval);
+        retval += "\n";
+    }
+    return retval;
+}
+
+template <typename Encrypt>
+static void benchEncryptAllocations(const char * name, Encrypt encrypt, const RSAPublicKey & key, const string & text, const string & expected)
+{
+    srand(2);
+    resetBigMathProfile();
+    string encrypted = encrypt(key, text);
+    size_t allocationCount = getBigMathProfile().allocationCount;
+    if(encrypted != expected)
+    {
+        cout << name << " encrypted differently" << endl;
+        exit(1);
+    }
+    size_t chunkCount = (text.size() + EncryptChunkSize - 1) / EncryptChunkSize;
+    cout << setw(12) << name << setw(14) << allocationCount << setw(14) << fixed << setprecision(1) << (double)allocationCount / chunkCount << endl;
+}
+
+struct EncryptOperation
+{
+    string (* encrypt)(const RSAPublicKey & key, const string & text);
+    const RSAPublicKey * key;
+    const string * text;
+    BigMathPool * pool; // NULL for the heap
+    void operator ()() const
+    {
+        if(!pool)
+        {
+            encrypt(*key, *text);
+            return;
+        }
+        ScopedBigMathArena arena(*pool);
+        encrypt(*key, *text);
+    }
+};
+
+static void benchEncryptArena(const RSAPublicKey & key, const string & text, const string & expected)
+{
+    BigMathPool pool;
+    srand(2);
+    string encrypted;
+    {
+        ScopedBigMathArena arena(pool);
+        encrypted = encryptWithOperators(key, text);
+    }
+    if(encrypted != expected)
+    {
+        cout << "arena encrypted differently" << endl;
+        exit(1);
+    }
+    EncryptOperation heapOperation = {encryptWithOperators, &key, &text, NULL};
+    EncryptOperation arenaOperation = {encryptWithOperators, &key, &text, &pool};
+    double heapTime = microsecondsPerOperation(heapOperation);
+    double arenaTime = microsecondsPerOperation(arenaOperation);
+    const BigMathPool::Statistics & statistics = pool.getStatistics();
+    cout << "encryptString with operators : heap vs a BigMathPool arena (us/call)" << endl;
+    cout << "        heap         arena   high water   chunk bytes" << endl;
+    cout << fixed << setprecision(1) << setw(12) << heapTime << setw(14) << arenaTime
+         << setw(13) << statistics.highWaterBytes << setw(14) << statistics.chunkBytes << endl;
+}
+
+static RandomGenerator randomGenerator;
+
+struct EncryptPayloadOperation
+{
+    const RSAPublicKey * key;
+    const string * text;
+    char version;
+    void operator ()() const
+    {
+        encryptPayload(*text, key, version, randomGenerator);
+    }
+};
+
+static void benchPayloadVersion(const RSAPublicKey & key, const string & text, char version)
+{
+    resetBigMathProfile();
+    encryptPayload(text, &key, version, randomGenerator);
+    size_t exponentiationCount = getBigMathProfile().operationCounts[BigMathPowMod];
+    EncryptPayloadOperation operation = {&key, &text, version};
+    cout << setw(8) << exponentiationCount << setw(12) << fixed << setprecision(1) << microsecondsPerOperation(operation);
+}
+
+static void benchPayloadVersions(const string & text)
+{
+    cout << "encryptPayload of " << text.size() << " bytes : RSA exponentiations and us per batch" << endl;
+    cout << "  bits  packed chunk   chunked ('1')        packed ('3')        hybrid ('2')" << endl;
+    const size_t bitCounts[] = {1024, 2048, 4096};
+    for(size_t i = 0; i < sizeof(bitCounts) / sizeof(bitCounts[0]); i++)
+    {
+        RSAPublicKey key(randomModulus(bitCounts[i]), BigUnsigned(0x10001));
+        cout << setw(6) << bitCounts[i] << setw(14) << getPackedChunkSize(key.getModulus());
+        benchPayloadVersion(key, text, ChunkedPayloadVersion);
+        benchPayloadVersion(key, text, PackedPayloadVersion);
+        benchPayloadVersion(key, text, HybridPayloadVersion);
+        cout << endl;
+    }
+}
+
+// what main.cpp's randomEngine did before RandomGenerator : one rand() per byte
+struct RandPerByteOperation
+{
+    WordType * words;
+    size_t count;
+    void operator ()() const
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            WordType v = 0;
+            for(size_t j = 0; j < BytesPerWord; j++)
+                v = (v << 8) | (WordType)(rand() & 0xFF);
+            words[i] = v;
+        }
+    }
+};
+
+struct FillWordsOperation
+{
+    WordType * words;
+    size_t count;
+    void operator ()() const
+    {
+        randomGenerator.fillWords(words, count);
+    }
+};
+
+static void benchRandom()
+{
+    const size_t WordCount = 64;
+    WordType words[WordCount];
+    RandPerByteOperation randPerByte = {words, WordCount};
+    FillWordsOperation fillWords = {words, WordCount};
+    double randTime = microsecondsPerOperation(randPerByte, 0.1) * 1000 / WordCount;
+    double fillTime = microsecondsPerOperation(fillWords, 0.1) * 1000 / WordCount;
+    cout << "random words : rand() per byte vs RandomGenerator::fillWords (ns/word)" << endl;
+    cout << fixed << setprecision(1) << setw(12) << randTime << setw(14) << fillTime << endl;
+}
+
+static void benchEncryptString()
+{
+    RSAPublicKey key(randomModulus(2048), BigUnsigned(0x10001));
+    string text = "people-counter\n";
+    while(text.size() < 1024)
+        text += "event 12345 inside\n";
+    srand(2);
+    string expected = encryptWithOperators(key, text);
+    cout << "encryptString of " << text.size() << " bytes with a 2048 bit key : BigUnsigned allocations" << endl;
+    cout << "     version     per call     per chunk" << endl;
+    benchEncryptAllocations("operators", encryptWithOperators, key, text, expected);
+    benchEncryptAllocations("in place", encryptInPlace, key, text, expected);
+    benchEncryptAllocations("fixed", encryptFixed, key, text, expected);
+    cout << endl;
+    benchEncryptArena(key, text, expected);
+    cout << endl;
+    benchPayloadVersions(text);
+}
+
+int main()
+{
+    srand(1);
+    cout << BitsPerWord << " bit words" << endl << endl;
+    cout << "powMod : division vs Montgomery (us/op)" << endl;
+    cout << "  bits  exponent      division    montgomery  speedup" << endl;
+    const size_t bitCounts[] = {512, 1024, 2048, 3072, 4096};
+    for(size_t i = 0; i < sizeof(bitCounts) / sizeof(bitCounts[0]); i++)
+    {
+        benchPowMod(bitCounts[i], BigUnsigned(0x10001), "65537");
+    }
+    for(size_t i = 0; i < 3; i++)
+    {
+        benchPowMod(bitCounts[i], randomNumber(bitCounts[i]), "full");
+    }
+    cout << endl;
+    benchKaratsubaCrossover();
+    cout << endl;
+    benchEncryptString();
+    cout << endl;
+    benchBase64();
+    cout << endl;
+    benchDecimal();
+    cout << endl;
+    benchGcd();
+    cout << endl;
+    benchRandom();
+    return 0;
+}
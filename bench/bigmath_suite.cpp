@@ -0,0 +1,225 @@
+// host benchmark suite for bigmath : make bench-suite && ./bench/bigmath_suite [results.csv]
+// Times each operation on operands of 1 to 128 words and counts every heap allocation it makes,
+// strings included. The CSV has a row per operation and size, for comparing one version with another.
+#include "bigmath.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+
+using namespace std;
+
+static size_t allocationCount = 0, allocatedBytes = 0;
+
+// the deletes aren't inlined so gcc doesn't pair free with the new expressions in the benchmarked code
+
+void * operator new(size_t size) throw(bad_alloc)
+{
+    allocationCount++;
+    allocatedBytes += size;
+    void * retval = malloc(size == 0 ? 1 : size);
+    if(retval == NULL)
+        throw bad_alloc();
+    return retval;
+}
+
+void * operator new[](size_t size) throw(bad_alloc)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void * p) throw()
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void * p) throw()
+{
+    free(p);
+}
+
+static BigUnsigned randomWords(size_t wordCount) // exactly wordCount words
+{
+    vector<WordType> words(wordCount);
+    for(size_t i = 0; i < wordCount; i++)
+    {
+        for(size_t j = 0; j < BytesPerWord; j++)
+            words[i] = (words[i] << 8) | (WordType)(rand() & 0xFF);
+    }
+    words[wordCount - 1] |= (WordType)1 << (BitsPerWord - 1);
+    return BigUnsigned::fromWords(&words[0], wordCount);
+}
+
+static string randomBytes(size_t byteCount)
+{
+    string retval(byteCount, '\0');
+    for(size_t i = 0; i < byteCount; i++)
+        retval[i] = (char)(rand() & 0xFF);
+    return retval;
+}
+
+struct Result
+{
+    double nanosecondsPerOperation, allocationsPerOperation, bytesPerOperation;
+};
+
+const double MinimumTime = 0.05;
+
+template <typename Operation>
+static Result measure(Operation operation)
+{
+    operation(); // fill caches like toString's powers of 10 outside the measurement
+    size_t count = 0, startAllocationCount = allocationCount, startAllocatedBytes = allocatedBytes;
+    clock_t start = clock();
+    double elapsed;
+    do // in doubling batches, so reading the clock doesn't count against small operations
+    {
+        for(size_t i = 0, batch = count + 1; i < batch; i++)
+            operation();
+        count += count + 1;
+    }
+    while((elapsed = (double)(clock() - start) / CLOCKS_PER_SEC) < MinimumTime);
+    Result retval;
+    retval.nanosecondsPerOperation = 1e9 * elapsed / count;
+    retval.allocationsPerOperation = (double)(allocationCount - startAllocationCount) / count;
+    retval.bytesPerOperation = (double)(allocatedBytes - startAllocatedBytes) / count;
+    return retval;
+}
+
+struct MultiplyOperation
+{
+    BigUnsigned a, b;
+    void operator ()() const
+    {
+        a * b;
+    }
+};
+
+struct SquareOperation
+{
+    BigUnsigned a;
+    void operator ()() const
+    {
+        square(a);
+    }
+};
+
+struct DivModOperation
+{
+    BigUnsigned dividend, divisor;
+    void operator ()() const
+    {
+        BigUnsigned quotient, remainder;
+        BigUnsigned::divMod(dividend, divisor, quotient, remainder);
+    }
+};
+
+struct PowModOperation
+{
+    BigUnsigned base, exponent, modulus;
+    void operator ()() const
+    {
+        powMod(base, exponent, modulus);
+    }
+};
+
+struct ToBase64Operation
+{
+    BigUnsigned v;
+    void operator ()() const
+    {
+        v.toBase64();
+    }
+};
+
+struct ToStringOperation
+{
+    BigUnsigned v;
+    void operator ()() const
+    {
+        v.toString(10);
+    }
+};
+
+struct ParseHexByteStringOperation
+{
+    string str;
+    void operator ()() const
+    {
+        BigUnsigned::parseHexByteString(str);
+    }
+};
+
+struct FromByteStringOperation
+{
+    string str;
+    void operator ()() const
+    {
+        BigUnsigned::fromByteString(str);
+    }
+};
+
+static ofstream csv;
+
+static void report(const char * operation, size_t wordCount, const Result & result)
+{
+    cout << setw(20) << operation << setw(7) << wordCount << fixed
+         << setprecision(1) << setw(14) << result.nanosecondsPerOperation
+         << setprecision(2) << setw(12) << result.allocationsPerOperation
+         << setprecision(1) << setw(12) << result.bytesPerOperation << endl;
+    if(csv.is_open())
+    {
+        csv << operation << "," << wordCount << "," << BitsPerWord << ","
+            << setprecision(1) << result.nanosecondsPerOperation << ","
+            << setprecision(2) << result.allocationsPerOperation << ","
+            << setprecision(1) << result.bytesPerOperation << "\n";
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    if(argc > 2)
+    {
+        cerr << "usage : " << argv[0] << " [results.csv]" << endl;
+        return 1;
+    }
+    if(argc == 2)
+    {
+        csv.open(argv[1]);
+        if(!csv)
+        {
+            cerr << "can't write " << argv[1] << endl;
+            return 1;
+        }
+        csv << fixed << "operation,words,word_bits,ns_per_op,allocations_per_op,bytes_per_op\n";
+    }
+    srand(1);
+    cout << BitsPerWord << " bit words" << endl;
+    cout << "           operation  words         ns/op   allocs/op    bytes/op" << endl;
+    const size_t wordCounts[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    const size_t sizeCount = sizeof(wordCounts) / sizeof(wordCounts[0]);
+    for(size_t i = 0; i < sizeCount; i++)
+    {
+        size_t n = wordCounts[i];
+        BigUnsigned a = randomWords(n), b = randomWords(n);
+        MultiplyOperation multiply = {a, b};
+        report("operator*", n, measure(multiply));
+        SquareOperation squareOperation = {a};
+        report("square", n, measure(squareOperation));
+        DivModOperation divMod = {a * b + randomWords(n), b}; // a 2n word dividend
+        report("divMod", n, measure(divMod));
+        PowModOperation powModOperation = {a, BigUnsigned(0x10001), b | (WordType)1};
+        report("powMod 65537", n, measure(powModOperation));
+        ToBase64Operation toBase64 = {a};
+        report("toBase64", n, measure(toBase64));
+        ToStringOperation toString = {a};
+        report("toString", n, measure(toString));
+        ParseHexByteStringOperation parseHexByteString = {a.toHexByteString()};
+        report("parseHexByteString", n, measure(parseHexByteString));
+        FromByteStringOperation fromByteString = {randomBytes(n * BytesPerWord - 1)}; // the leading 1 byte fills the top word
+        report("fromByteString", n, measure(fromByteString));
+    }
+    return 0;
+}
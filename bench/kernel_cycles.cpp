@@ -0,0 +1,89 @@
+// Cortex-M3 cycles for the bigmath row kernels : make kernel_cycles.bin and flash it, then read
+// the DWT cycle counts from the mbed serial port. This is the only measurement of the assembly,
+// the host builds use the portable C++ kernels.
+#include "bigmath.h"
+#include "mbed.h"
+#include <cstdio>
+
+// the DWT registers aren't in this CMSIS version's core_cm3.h
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+
+static void startCycleCount()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= 1;
+}
+
+static unsigned long readCycleCount()
+{
+    return DWT_CYCCNT;
+}
+
+const size_t MaxWords = 128;
+
+static WordType x[MaxWords], y[MaxWords], dest[2 * MaxWords + 1];
+
+static WordType randomWord()
+{
+    static uint32_t state = 2463534242U;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (WordType)state;
+}
+
+enum Kernel
+{
+    Mul1,
+    AddMul1,
+    SubMul1,
+    Multiply,
+    Square
+};
+
+static unsigned long countCycles(Kernel kernel, size_t len)
+{
+    startCycleCount();
+    switch(kernel)
+    {
+    case Mul1:
+        mul_1(dest, x, len, y[0]);
+        break;
+    case AddMul1:
+        addmul_1(dest, x, len, y[0]);
+        break;
+    case SubMul1:
+        submul_1(dest, x, len, y[0]);
+        break;
+    case Multiply:
+        multiplyWords(dest, x, len, y, len);
+        break;
+    case Square:
+        squareWords(dest, x, len);
+        break;
+    }
+    return readCycleCount();
+}
+
+int main()
+{
+    for(size_t i = 0; i < MaxWords; i++)
+    {
+        x[i] = randomWord();
+        y[i] = randomWord();
+    }
+    printf("row kernels : Cortex-M3 cycles per word\r\n");
+    printf(" words     mul_1  addmul_1  submul_1  multiplyWords  squareWords\r\n");
+    for(size_t len = 1; len <= MaxWords; len *= 2)
+    {
+        printf("%6u", (unsigned)len);
+        printf("%10.1f", (double)countCycles(Mul1, len) / len);
+        printf("%10.1f", (double)countCycles(AddMul1, len) / len);
+        printf("%10.1f", (double)countCycles(SubMul1, len) / len);
+        printf("%15.1f", (double)countCycles(Multiply, len) / (len * len));
+        printf("%13.1f\r\n", (double)countCycles(Square, len) / (len * len));
+    }
+    return 0;
+}
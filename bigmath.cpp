@@ -4,6 +4,183 @@
 
 BigUnsigned::Data * BigUnsigned::smallNumbers = NULL;
 
+void BigUnsigned::Data::destroy(Data * data)
+{
+    BigMathAllocator * dataAllocator = data->getAllocator();
+    data->~Data();
+    deallocateBigMath(dataAllocator, data, sizeof(Data));
+}
+
+#ifdef BIGMATH_PROFILE
+BigMathProfile bigMathProfile;
+
+BigMathProfile getBigMathProfile()
+{
+    return bigMathProfile;
+}
+
+void resetBigMathProfile()
+{
+    size_t liveBytes = bigMathProfile.liveBytes;
+    bigMathProfile = BigMathProfile();
+    bigMathProfile.liveBytes = liveBytes;
+    bigMathProfile.peakBytes = liveBytes;
+}
+
+const char * getBigMathOperationName(BigMathOperation operation)
+{
+    static const char * const names[BigMathOperationCount] =
+    {
+        "add", "subtract", "multiply", "square", "divide", "shift", "gcd", "powMod", "convert"
+    };
+    return names[operation];
+}
+
+void printBigMathProfile(const BigMathProfile & profile)
+{
+    printf("bigmath : %u allocations, %u bytes, %u live, %u peak, %u copy on write, %u expand\r\n",
+           (unsigned)profile.allocationCount, (unsigned)profile.allocatedBytes, (unsigned)profile.liveBytes,
+           (unsigned)profile.peakBytes, (unsigned)profile.copyOnWriteCount, (unsigned)profile.expandCount);
+    for(int i = 0; i < BigMathOperationCount; i++)
+    {
+        if(profile.operationCounts[i] != 0)
+            printf("  %s : %u\r\n", getBigMathOperationName((BigMathOperation)i), (unsigned)profile.operationCounts[i]);
+    }
+}
+#endif
+
+#ifdef BIGMATH_POOL
+BigMathAllocator * bigMathAllocator = NULL;
+
+BigMathPool::BigMathPool(size_t chunkSize)
+    : chunkSize(chunkSize), firstChunk(NULL), currentChunk(NULL), statistics()
+{
+    for(size_t i = 0; i < ClassCount; i++)
+        freeBlocks[i] = NULL;
+}
+
+BigMathPool::~BigMathPool()
+{
+    while(firstChunk)
+    {
+        Chunk * next = firstChunk->next;
+        ::operator delete(firstChunk);
+        firstChunk = next;
+    }
+}
+
+size_t BigMathPool::getSizeClass(size_t bytes) // ClassCount for blocks too big for a class
+{
+    size_t sizeClass = 0;
+    while(sizeClass < ClassCount && ((size_t)MinimumBlockSize << sizeClass) < bytes)
+        sizeClass++;
+    return sizeClass;
+}
+
+size_t BigMathPool::getBlockSize(size_t bytes) const
+{
+    size_t sizeClass = getSizeClass(bytes);
+    if(sizeClass == ClassCount)
+        return bytes;
+    return (size_t)MinimumBlockSize << sizeClass;
+}
+
+void * BigMathPool::allocateFromChunks(size_t bytes)
+{
+    // after a release the chunks are used again in order, skipping what's left at the end of each
+    while(!currentChunk || currentChunk->used + bytes > currentChunk->size)
+    {
+        if(currentChunk && currentChunk->next)
+        {
+            currentChunk = currentChunk->next;
+            currentChunk->used = 0;
+            continue;
+        }
+        size_t size = max(chunkSize, bytes);
+        Chunk * chunk = (Chunk *)::operator new(ChunkHeaderSize + size);
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+        statistics.chunkBytes += ChunkHeaderSize + size;
+        if(currentChunk)
+            currentChunk->next = chunk;
+        else
+            firstChunk = chunk;
+        currentChunk = chunk;
+    }
+    void * retval = (char *)currentChunk + ChunkHeaderSize + currentChunk->used;
+    currentChunk->used += bytes;
+    return retval;
+}
+
+void * BigMathPool::allocate(size_t bytes)
+{
+    size_t sizeClass = getSizeClass(bytes);
+    void * retval;
+    if(sizeClass == ClassCount)
+        retval = ::operator new(bytes);
+    else
+    {
+        bytes = (size_t)MinimumBlockSize << sizeClass;
+        if(freeBlocks[sizeClass])
+        {
+            retval = freeBlocks[sizeClass];
+            freeBlocks[sizeClass] = freeBlocks[sizeClass]->next;
+        }
+        else
+            retval = allocateFromChunks(bytes);
+    }
+    statistics.liveBlocks[sizeClass]++;
+    statistics.highWaterBlocks[sizeClass] = max(statistics.highWaterBlocks[sizeClass], statistics.liveBlocks[sizeClass]);
+    statistics.liveBytes += bytes;
+    statistics.highWaterBytes = max(statistics.highWaterBytes, statistics.liveBytes);
+    return retval;
+}
+
+void BigMathPool::deallocate(void * p, size_t bytes)
+{
+    size_t sizeClass = getSizeClass(bytes);
+    if(sizeClass == ClassCount)
+        ::operator delete(p);
+    else
+    {
+        bytes = (size_t)MinimumBlockSize << sizeClass;
+        FreeBlock * block = (FreeBlock *)p;
+        block->next = freeBlocks[sizeClass];
+        freeBlocks[sizeClass] = block;
+    }
+    statistics.liveBlocks[sizeClass]--;
+    statistics.liveBytes -= bytes;
+}
+
+void BigMathPool::release()
+{
+    if(statistics.liveBytes != 0)
+        handleError("a value outlived its arena in BigMathPool::release");
+    for(size_t i = 0; i < ClassCount; i++)
+        freeBlocks[i] = NULL;
+    currentChunk = firstChunk;
+    if(currentChunk)
+        currentChunk->used = 0;
+}
+
+void BigMathPool::printStatistics() const
+{
+    printf("pool : %u live bytes, %u high water, %u in chunks\r\n",
+           (unsigned)statistics.liveBytes, (unsigned)statistics.highWaterBytes, (unsigned)statistics.chunkBytes);
+    for(size_t i = 0; i <= ClassCount; i++)
+    {
+        if(statistics.highWaterBlocks[i] == 0)
+            continue;
+        if(i < ClassCount)
+            printf("  %u bytes : %u live, %u high water\r\n", (unsigned)MinimumBlockSize << i,
+                   (unsigned)statistics.liveBlocks[i], (unsigned)statistics.highWaterBlocks[i]);
+        else
+            printf("  larger : %u live, %u high water\r\n", (unsigned)statistics.liveBlocks[i], (unsigned)statistics.highWaterBlocks[i]);
+    }
+}
+#endif
+
 static inline void addWithCarry(WordType a, WordType b, bool carryIn, WordType & result, bool & carryOut)
 {
     DoubleWordType v = a;
@@ -59,6 +236,38 @@ static inline void divideDoubleWord(WordType dividendHighWord, WordType dividend
     remainder = (WordType)(dividend % divisor);
 }
 
+/** floor((2 ^ (2 * BitsPerWord) - 1) / divisor) - 2 ^ BitsPerWord for a divisor with its top bit set.
+  * The one real division it costs is shared by every divideDoubleWordByReciprocal() with that divisor.
+  */
+static inline WordType reciprocalWord(WordType divisor)
+{
+    WordType retval, remainder;
+    divideDoubleWord(~divisor, WordMax, divisor, retval, remainder);
+    return retval;
+}
+
+/** divideDoubleWord() for dividendHighWord < divisor, divisor with its top bit set and reciprocal = reciprocalWord(divisor),
+  * with two multiplies instead of a division : algorithm 4 of Moller and Granlund, "Improved division by invariant integers".
+  */
+static inline void divideDoubleWordByReciprocal(WordType dividendHighWord, WordType dividendLowWord, WordType divisor, WordType reciprocal, WordType & quotient, WordType & remainder)
+{
+    DoubleWordType q = reciprocal;
+    q *= dividendHighWord;
+    q += ((DoubleWordType)(dividendHighWord + 1) << BitsPerWord) | dividendLowWord;
+    quotient = (WordType)(q >> BitsPerWord);
+    remainder = dividendLowWord - quotient * divisor;
+    if(remainder > (WordType)(q & WordMax))
+    {
+        quotient--;
+        remainder += divisor;
+    }
+    if(remainder >= divisor)
+    {
+        quotient++;
+        remainder -= divisor;
+    }
+}
+
 static inline void lshiftDoubleWord(WordType highWordIn, WordType lowWordIn, size_t shiftCount, WordType & highWordOut)
 {
     DoubleWordType v = highWordIn;
@@ -77,7 +286,107 @@ static inline void rshiftDoubleWord(WordType highWordIn, WordType lowWordIn, siz
     lowWordOut = (WordType)(v & WordMax);
 }
 
-static void handleError(string msg)
+#if BIGMATH_WORD_BITS == 32 && (defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__))
+#define BIGMATH_ARM_KERNELS
+#endif
+
+// carry:word = x * y + carry
+static inline void mul_1Step(WordType & word, WordType x, WordType y, WordType & carry)
+{
+#ifdef BIGMATH_ARM_KERNELS
+    WordType high;
+    __asm__("umull %[low], %[high], %[x], %[y]\n\t"
+            "adds %[low], %[low], %[carry]\n\t"
+            "adc %[carry], %[high], #0"
+            : [low] "=&r"(word), [high] "=&r"(high), [carry] "+r"(carry)
+            : [x] "r"(x), [y] "r"(y)
+            : "cc");
+#else
+    multiplyDoubleWordAndAdd(x, y, carry, carry, word);
+#endif
+}
+
+// carry:word = word + x * y + carry, which can't overflow
+static inline void addmul_1Step(WordType & word, WordType x, WordType y, WordType & carry)
+{
+#ifdef BIGMATH_ARM_KERNELS
+    WordType high = 0;
+    __asm__("umlal %[carry], %[high], %[x], %[y]\n\t"
+            "adds %[word], %[word], %[carry]\n\t"
+            "adc %[carry], %[high], #0"
+            : [word] "+r"(word), [high] "+r"(high), [carry] "+r"(carry)
+            : [x] "r"(x), [y] "r"(y)
+            : "cc");
+#else
+    multiplyDoubleWordAndAddTwo(x, y, word, carry, carry, word);
+#endif
+}
+
+// word = word - x * y - carry, with carry the word borrowed from above
+static inline void submul_1Step(WordType & word, WordType x, WordType y, WordType & carry)
+{
+#ifdef BIGMATH_ARM_KERNELS
+    WordType high = 0;
+    __asm__("umlal %[carry], %[high], %[x], %[y]\n\t"
+            "subs %[word], %[word], %[carry]\n\t"
+            "it cc\n\t"
+            "addcc %[high], %[high], #1\n\t"
+            "mov %[carry], %[high]"
+            : [word] "+r"(word), [high] "+r"(high), [carry] "+r"(carry)
+            : [x] "r"(x), [y] "r"(y)
+            : "cc");
+#else
+    WordType product;
+    multiplyDoubleWordAndAdd(x, y, carry, carry, product);
+    WordType oldWord = word;
+    word = oldWord - product;
+    if(word > oldWord)
+        carry++;
+#endif
+}
+
+WordType mul_1(WordType dest[], const WordType x[], size_t len, WordType y, WordType carry)
+{
+    size_t i = 0;
+    if(len % 2 != 0)
+        mul_1Step(dest[i++], x[0], y, carry);
+    for(; i < len; i += 2)
+    {
+        mul_1Step(dest[i], x[i], y, carry);
+        mul_1Step(dest[i + 1], x[i + 1], y, carry);
+    }
+    return carry;
+}
+
+WordType addmul_1(WordType dest[], const WordType x[], size_t len, WordType y)
+{
+    WordType carry = 0;
+    size_t i = 0;
+    if(len % 2 != 0)
+        addmul_1Step(dest[i++], x[0], y, carry);
+    for(; i < len; i += 2)
+    {
+        addmul_1Step(dest[i], x[i], y, carry);
+        addmul_1Step(dest[i + 1], x[i + 1], y, carry);
+    }
+    return carry;
+}
+
+WordType submul_1(WordType dest[], const WordType x[], size_t len, WordType y)
+{
+    WordType carry = 0;
+    size_t i = 0;
+    if(len % 2 != 0)
+        submul_1Step(dest[i++], x[0], y, carry);
+    for(; i < len; i += 2)
+    {
+        submul_1Step(dest[i], x[i], y, carry);
+        submul_1Step(dest[i + 1], x[i + 1], y, carry);
+    }
+    return carry;
+}
+
+void handleError(string msg)
 {
 #if 0
     throw runtime_error(msg);
@@ -89,6 +398,7 @@ static void handleError(string msg)
 
 BigUnsigned BigUnsigned::parseHexByteString(string str)
 {
+    profileBigMathOperation(BigMathConvert);
     size_t byteCount = 0;
     int hexDigitCount = 0;
     for(size_t i = 0; i < str.size(); i++)
@@ -167,6 +477,7 @@ BigUnsigned BigUnsigned::parseHexByteString(string str)
 
 string BigUnsigned::toHexByteString() const
 {
+    profileBigMathOperation(BigMathConvert);
     size_t byteCount = data->size * BytesPerWord;
     while(byteCount > 1 && (((data->words[(byteCount - 1) / BytesPerWord]) >> ((byteCount - 1) % BytesPerWord) * 8) & 0xFF) == 0)
         byteCount--;
@@ -185,6 +496,7 @@ string BigUnsigned::toHexByteString() const
 
 BigUnsigned BigUnsigned::fromByteString(string str)
 {
+    profileBigMathOperation(BigMathConvert);
     size_t byteCount = str.size() + 1;
     size_t wordCount = (byteCount + BytesPerWord - 1) / BytesPerWord;
     BigUnsigned retval(0, wordCount);
@@ -195,7 +507,7 @@ BigUnsigned BigUnsigned::fromByteString(string str)
     retval.data->words[wordPos] |= ((WordType)currentByte << (8 * (bytePos % BytesPerWord)));
     for(size_t i = 0; i < str.size(); i++)
     {
-        unsigned currentByte = str[i];
+        unsigned currentByte = (uint8_t)str[i];
         size_t bytePos = byteCount - ++byteNumber;
         size_t wordPos = bytePos / BytesPerWord;
         retval.data->words[wordPos] |= ((WordType)currentByte << (8 * (bytePos % BytesPerWord)));
@@ -206,6 +518,7 @@ BigUnsigned BigUnsigned::fromByteString(string str)
 
 string BigUnsigned::toByteString() const
 {
+    profileBigMathOperation(BigMathConvert);
     size_t byteCount = data->size * BytesPerWord;
     while(byteCount > 1 && (((data->words[(byteCount - 1) / BytesPerWord]) >> ((byteCount - 1) % BytesPerWord) * 8) & 0xFF) == 0)
         byteCount--;
@@ -222,12 +535,13 @@ string BigUnsigned::toByteString() const
     return retval;
 }
 
-const BigUnsigned & BigUnsigned::operator +=(BigUnsigned b)
+const BigUnsigned & BigUnsigned::operator +=(const BigUnsigned & b)
 {
     if(b.data->size == 1)
         return operator +=(b.data->words[0]);
-    onWrite();
+    profileBigMathOperation(BigMathAdd);
     size_t size = max(data->size, b.data->size) + 1;
+    onWrite(size);
     data->expand(size);
     bool carry = false;
     for(size_t i = 0; i < size; i++)
@@ -245,7 +559,8 @@ const BigUnsigned & BigUnsigned::operator +=(BigUnsigned b)
 
 const BigUnsigned & BigUnsigned::operator +=(WordType b)
 {
-    onWrite();
+    profileBigMathOperation(BigMathAdd);
+    onWrite(data->size + 1);
     bool carry = false;
     addWithCarry(data->words[0], b, carry, data->words[0], carry);
     if(!carry)
@@ -260,8 +575,9 @@ const BigUnsigned & BigUnsigned::operator +=(WordType b)
     return *this;
 }
 
-const BigUnsigned & BigUnsigned::operator -=(BigUnsigned b)
+const BigUnsigned & BigUnsigned::operator -=(const BigUnsigned & b)
 {
+    profileBigMathOperation(BigMathSubtract);
     onWrite();
     if(*this < b)
         handleError("subtraction has negative result in BigUnsigned::operator -=");
@@ -285,6 +601,7 @@ const BigUnsigned & BigUnsigned::operator -=(BigUnsigned b)
 
 const BigUnsigned & BigUnsigned::operator -=(WordType b)
 {
+    profileBigMathOperation(BigMathSubtract);
     onWrite();
     if(*this < b)
         handleError("subtraction has negative result in BigUnsigned::operator -=");
@@ -303,7 +620,7 @@ const BigUnsigned & BigUnsigned::operator -=(WordType b)
     return *this;
 }
 
-BigUnsigned operator *(BigUnsigned a, WordType b)
+BigUnsigned operator *(const BigUnsigned & a, WordType b)
 {
     if(b == 0)
         return BigUnsigned(0);
@@ -311,6 +628,7 @@ BigUnsigned operator *(BigUnsigned a, WordType b)
         return a;
     if(a.data->size == 1)
     {
+        profileBigMathOperation(BigMathMultiply);
         WordType highWord, lowWord;
         multiplyDoubleWord(a.data->words[0], b, highWord, lowWord);
         if(highWord == 0)
@@ -319,40 +637,318 @@ BigUnsigned operator *(BigUnsigned a, WordType b)
         retval.data->words[1] = highWord;
         return retval;
     }
+    BigUnsigned retval;
+    mulAdd(retval, a, b, 0);
+    return retval;
+}
 
-    WordType carry = 0;
-    a.onWrite();
-    a.data->resize(a.data->size + 1);
-    for(size_t i = 0; i < a.data->size - 1; i++)
+void mulAdd(BigUnsigned & dst, const BigUnsigned & a, WordType b, WordType c)
+{
+    profileBigMathOperation(BigMathMultiply);
+    // dst may be a, so read a's words through its Data after any reallocation
+    const BigUnsigned::Data * source = a.data;
+    size_t size = source->size;
+    dst.onWrite(size + 1);
+    dst.data->resize(size + 1);
+    dst.data->words[size] = mul_1(dst.data->words, source->words, size, b, c);
+    dst.normalize();
+}
+
+size_t BigUnsigned::karatsubaThreshold = 32;
+
+/** Compute result[0:aSize+bSize-1] = a[0:aSize-1] * b[0:bSize-1] with the schoolbook method.
+  * result must not overlap a or b.
+  */
+void multiplyWords(WordType result[], const WordType a[], size_t aSize, const WordType b[], size_t bSize)
+{
+    result[aSize] = mul_1(result, a, aSize, b[0]);
+    for(size_t i = 1; i < bSize; i++)
     {
-        multiplyDoubleWordAndAdd(a.data->words[i], b, carry, carry, a.data->words[i]);
+        result[i + aSize] = addmul_1(result + i, a, aSize, b[i]);
     }
-    a.data->words[a.data->size - 1] = carry;
-    a.normalize();
-    return a;
 }
 
-BigUnsigned operator *(BigUnsigned a, BigUnsigned b)
+/** Compute result[0:2*size-1] = a[0:size-1] squared, computing each cross product only once. */
+void squareWords(WordType result[], const WordType a[], size_t size)
 {
-    if(a.data->size < b.data->size)
-        swap(a, b);
-    if(b.data->size == 1)
-        return operator *(a, b.data->words[0]);
-    BigUnsigned retval(0, a.data->size + b.data->size);
-    WordType carry = 0;
-    for(size_t i = 0; i < a.data->size; i++)
+    for(size_t i = 0; i < 2 * size; i++)
+        result[i] = 0;
+    for(size_t i = 0; i + 1 < size; i++)
+    {
+        result[i + size] = addmul_1(result + 2 * i + 1, a + i + 1, size - i - 1, a[i]);
+    }
+    // double the cross products; they sum to less than half the square so nothing is shifted out
+    WordType shiftedOut = 0;
+    for(size_t i = 0; i < 2 * size; i++)
+    {
+        WordType word = result[i];
+        result[i] = (word << 1) | shiftedOut;
+        shiftedOut = word >> (BitsPerWord - 1);
+    }
+    bool carry = false;
+    for(size_t i = 0; i < size; i++)
+    {
+        WordType highWord, lowWord;
+        multiplyDoubleWord(a[i], a[i], highWord, lowWord);
+        addWithCarry(result[2 * i], lowWord, carry, result[2 * i], carry);
+        addWithCarry(result[2 * i + 1], highWord, carry, result[2 * i + 1], carry);
+    }
+}
+
+/** Compare a[0:size-1] with b[0:size-1], returning -1, 0 or 1. */
+int compareWords(const WordType a[], const WordType b[], size_t size)
+{
+    for(size_t i = 0, j = size - 1; i < size; i++, j--)
+    {
+        if(a[j] > b[j])
+            return 1;
+        if(a[j] < b[j])
+            return -1;
+    }
+    return 0;
+}
+
+/** Add b[0:bSize-1] to a[0:aSize-1] in place, aSize >= bSize. returns the carry out of a's top word. */
+bool addWords(WordType a[], size_t aSize, const WordType b[], size_t bSize)
+{
+    bool carry = false;
+    size_t i;
+    for(i = 0; i < bSize; i++)
+    {
+        addWithCarry(a[i], b[i], carry, a[i], carry);
+    }
+    for(; carry && i < aSize; i++)
+    {
+        carry = (++a[i] == 0);
+    }
+    return carry;
+}
+
+/** Subtract b[0:bSize-1] from a[0:aSize-1] in place, aSize >= bSize. returns the borrow out of a's top word. */
+bool subtractWords(WordType a[], size_t aSize, const WordType b[], size_t bSize)
+{
+    bool borrow = false;
+    size_t i;
+    for(i = 0; i < bSize; i++)
+    {
+        subtractWithBorrow(a[i], b[i], borrow, a[i], borrow);
+    }
+    for(; borrow && i < aSize; i++)
     {
-        multiplyDoubleWordAndAdd(a.data->words[i], b.data->words[0], carry, carry, retval.data->words[i]);
+        borrow = (a[i]-- == 0);
     }
-    retval.data->words[a.data->size] = carry;
-    for(size_t i = 1; i < b.data->size; i++)
+    return borrow;
+}
+
+/** Compute result[0:size-1] = |a[0:size-1] - b[0:size-1]|. returns true if a < b. */
+static bool absoluteDifference(WordType result[], const WordType a[], const WordType b[], size_t size)
+{
+    bool aIsLess = false;
+    for(size_t i = 0, j = size - 1; i < size; i++, j--)
     {
-        carry = 0;
-        for(size_t j = 0; j < a.data->size; j++)
+        if(a[j] != b[j])
         {
-            multiplyDoubleWordAndAddTwo(a.data->words[j], b.data->words[i], carry, retval.data->words[i + j], carry, retval.data->words[i + j]);
+            aIsLess = a[j] < b[j];
+            break;
         }
-        retval.data->words[i + a.data->size] = carry;
+    }
+    if(aIsLess)
+        std::swap(a, b);
+    bool borrow = false;
+    for(size_t i = 0; i < size; i++)
+    {
+        subtractWithBorrow(a[i], b[i], borrow, result[i], borrow);
+    }
+    return aIsLess;
+}
+
+/** the number of scratch words karatsubaMultiply needs for size word operands */
+static size_t karatsubaScratchSize(size_t size)
+{
+    size_t retval = 0;
+    while(size >= BigUnsigned::karatsubaThreshold && size > 1)
+    {
+        size_t high = size - size / 2;
+        retval += 6 * high + 1;
+        size = high;
+    }
+    return retval;
+}
+
+/** Compute result[0:2*size-1] = a[0:size-1] * b[0:size-1].
+  * Uses Karatsuba's method, with the difference form so there are no carry words,
+  * dropping to the schoolbook method below BigUnsigned::karatsubaThreshold words.
+  * scratch must have karatsubaScratchSize(size) words. result must not overlap a or b.
+  */
+static void karatsubaMultiply(WordType result[], const WordType a[], const WordType b[], size_t size, WordType scratch[])
+{
+    if(size < BigUnsigned::karatsubaThreshold || size <= 1)
+    {
+        multiplyWords(result, a, size, b, size);
+        return;
+    }
+    // a = a1 * B ^ low + a0 and b = b1 * B ^ low + b0, with the high halves at least as long as the low halves
+    size_t low = size / 2, high = size - low;
+    WordType * aDifference = scratch;
+    WordType * bDifference = aDifference + high;
+    WordType * product = bDifference + high;
+    WordType * middle = product + 2 * high;
+    WordType * nextScratch = middle + 2 * high + 1;
+    // the low halves are padded to high words using the top of each scratch difference
+    for(size_t i = 0; i < high; i++)
+    {
+        aDifference[i] = i < low ? a[i] : 0;
+        bDifference[i] = i < low ? b[i] : 0;
+    }
+    bool negative = absoluteDifference(aDifference, a + low, aDifference, high);
+    negative ^= absoluteDifference(bDifference, b + low, bDifference, high);
+    karatsubaMultiply(product, aDifference, bDifference, high, nextScratch);
+    karatsubaMultiply(result, a, b, low, nextScratch);
+    karatsubaMultiply(result + 2 * low, a + low, b + low, high, nextScratch);
+    // middle = a0 * b0 + a1 * b1 -+ (a1 - a0) * (b1 - b0) = a0 * b1 + a1 * b0
+    for(size_t i = 0; i < 2 * high + 1; i++)
+        middle[i] = i < 2 * high ? result[2 * low + i] : 0;
+    addWords(middle, 2 * high + 1, result, 2 * low);
+    if(negative)
+        addWords(middle, 2 * high + 1, product, 2 * high);
+    else
+        subtractWords(middle, 2 * high + 1, product, 2 * high);
+    addWords(result + low, 2 * size - low, middle, 2 * high + 1);
+}
+
+/** Compute result[0:2*size-1] = a[0:size-1] squared.
+  * Karatsuba's method specialized for squaring, dropping to squareWords below BigUnsigned::karatsubaThreshold words.
+  * scratch must have karatsubaScratchSize(size) words. result must not overlap a.
+  */
+static void karatsubaSquare(WordType result[], const WordType a[], size_t size, WordType scratch[])
+{
+    if(size < BigUnsigned::karatsubaThreshold || size <= 1)
+    {
+        squareWords(result, a, size);
+        return;
+    }
+    size_t low = size / 2, high = size - low;
+    WordType * difference = scratch;
+    WordType * product = difference + high;
+    WordType * middle = product + 2 * high;
+    WordType * nextScratch = middle + 2 * high + 1;
+    for(size_t i = 0; i < high; i++)
+        difference[i] = i < low ? a[i] : 0;
+    absoluteDifference(difference, a + low, difference, high);
+    karatsubaSquare(product, difference, high, nextScratch);
+    karatsubaSquare(result, a, low, nextScratch);
+    karatsubaSquare(result + 2 * low, a + low, high, nextScratch);
+    // middle = a0 * a0 + a1 * a1 - (a1 - a0) * (a1 - a0) = 2 * a0 * a1
+    for(size_t i = 0; i < 2 * high + 1; i++)
+        middle[i] = i < 2 * high ? result[2 * low + i] : 0;
+    addWords(middle, 2 * high + 1, result, 2 * low);
+    subtractWords(middle, 2 * high + 1, product, 2 * high);
+    addWords(result + low, 2 * size - low, middle, 2 * high + 1);
+}
+
+/** the number of scratch words multiplyLongWords needs */
+static size_t multiplyScratchSize(size_t bSize)
+{
+    if(bSize < BigUnsigned::karatsubaThreshold)
+        return 0;
+    return 2 * bSize + karatsubaScratchSize(bSize);
+}
+
+/** Compute result[0:aSize+bSize-1] = a[0:aSize-1] * b[0:bSize-1], aSize >= bSize,
+  * picking the schoolbook or Karatsuba method by size. Unbalanced operands are
+  * multiplied in bSize word slices of a. scratch must have multiplyScratchSize(bSize) words.
+  */
+static void multiplyLongWords(WordType result[], const WordType a[], size_t aSize, const WordType b[], size_t bSize, WordType scratch[])
+{
+    if(bSize < BigUnsigned::karatsubaThreshold)
+    {
+        multiplyWords(result, a, aSize, b, bSize);
+        return;
+    }
+    if(aSize == bSize)
+    {
+        karatsubaMultiply(result, a, b, bSize, scratch);
+        return;
+    }
+    WordType * product = scratch;
+    WordType * nextScratch = product + 2 * bSize;
+    for(size_t i = 0; i < aSize + bSize; i++)
+        result[i] = 0;
+    for(size_t offset = 0; offset < aSize; offset += bSize)
+    {
+        size_t sliceSize = min(bSize, aSize - offset);
+        if(sliceSize == bSize)
+            karatsubaMultiply(product, a + offset, b, bSize, nextScratch);
+        else
+            multiplyWords(product, b, bSize, a + offset, sliceSize);
+        addWords(result + offset, aSize + bSize - offset, product, bSize + sliceSize);
+    }
+}
+
+BigUnsigned operator *(const BigUnsigned & a, const BigUnsigned & b)
+{
+    if(a.data->size == 1)
+        return operator *(b, a.data->words[0]);
+    if(b.data->size == 1)
+        return operator *(a, b.data->words[0]);
+    BigUnsigned retval;
+    mulAdd(retval, a, b, BigUnsigned(0));
+    return retval;
+}
+
+void mulAdd(BigUnsigned & dst, const BigUnsigned & a, const BigUnsigned & b, const BigUnsigned & c)
+{
+    if(b.data->size == 1 && c.data->size == 1)
+    {
+        mulAdd(dst, a, b.data->words[0], c.data->words[0]);
+        return;
+    }
+    if(&dst == &a || &dst == &b || &dst == &c)
+    {
+        BigUnsigned retval;
+        mulAdd(retval, a, b, c);
+        dst.swap(retval);
+        return;
+    }
+    profileBigMathOperation(BigMathMultiply);
+    // dst isn't an operand, so if it shares Data with one onWrite gives it its own
+    const BigUnsigned::Data * x = a.data;
+    const BigUnsigned::Data * y = b.data;
+    if(x->size < y->size)
+        std::swap(x, y);
+    size_t productSize = x->size + y->size;
+    size_t size = max(productSize, c.data->size) + 1;
+    dst.onWrite(size);
+    dst.data->resize(size);
+    WordType * result = dst.data->words;
+    size_t scratchSize = multiplyScratchSize(y->size);
+    if(scratchSize == 0)
+        multiplyWords(result, x->words, x->size, y->words, y->size);
+    else
+    {
+        BigUnsigned scratch(0, scratchSize);
+        multiplyLongWords(result, x->words, x->size, y->words, y->size, scratch.data->words);
+    }
+    for(size_t i = productSize; i < size; i++)
+        result[i] = 0;
+    addWords(result, size, c.data->words, c.data->size);
+    dst.normalize();
+}
+
+BigUnsigned square(const BigUnsigned & a)
+{
+    if(a.data->size == 1)
+        return operator *(a, a.data->words[0]);
+    profileBigMathOperation(BigMathSquare);
+    size_t size = a.data->size;
+    BigUnsigned retval(0, 2 * size);
+    size_t scratchSize = karatsubaScratchSize(size);
+    if(scratchSize == 0)
+        squareWords(retval.data->words, a.data->words, size);
+    else
+    {
+        BigUnsigned scratch(0, scratchSize);
+        karatsubaSquare(retval.data->words, a.data->words, size, scratch.data->words);
     }
     retval.normalize();
     return retval;
@@ -360,6 +956,7 @@ BigUnsigned operator *(BigUnsigned a, BigUnsigned b)
 
 static void divMod(WordType dividend, WordType divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
 {
+    profileBigMathOperation(BigMathDivide);
     if(divisor == 0)
         handleError("division by 0 in BigUnsigned::divMod");
     if(pquotient)
@@ -368,7 +965,7 @@ static void divMod(WordType dividend, WordType divisor, BigUnsigned * pquotient,
         *premainder = dividend % divisor;
 }
 
-static void lshiftWords(WordType dest[], WordType src[], size_t size, size_t shiftCount) // either src == dest or they aren't overlapping
+void lshiftWords(WordType dest[], const WordType src[], size_t size, size_t shiftCount) // either src == dest or they aren't overlapping
 {
     if(shiftCount == 0)
     {
@@ -387,7 +984,7 @@ static void lshiftWords(WordType dest[], WordType src[], size_t size, size_t shi
     }
 }
 
-static void rshiftWords(WordType dest[], WordType src[], size_t size, size_t shiftCount) // either src == dest or they aren't overlapping
+void rshiftWords(WordType dest[], const WordType src[], size_t size, size_t shiftCount) // either src == dest or they aren't overlapping
 {
     if(shiftCount == 0)
     {
@@ -417,27 +1014,38 @@ static size_t countLeadingZeros(WordType v)
     return retval;
 }
 
-  /* Subtract x[0:len-1]*y from dest[offset:offset+len-1]. from http://www.opensource.apple.com/source/gcc/gcc-5484/libjava/gnu/java/math/MPN.java
-   * All values are treated as if unsigned.
-   * @return the most significant word of
-   * the product, minus borrow-out from the subtraction.
-   */
-static WordType submul_1(WordType dest[], size_t offset, const WordType x[], size_t len, WordType y)
+/** quotient[0:size-1] = a[0:size-1] / divisor, returning the remainder. quotient may be a or NULL.
+  * The divisor is normalized once so each word is divided using its reciprocal.
+  */
+static WordType divideWordsByWord(WordType quotient[], const WordType a[], size_t size, WordType divisor)
 {
-    WordType carry = 0;
-    size_t j = 0;
-    do
+    WordType q, remainder = 0;
+    if(size < 2) // the reciprocal would cost as much as the division it saves
+    {
+        for(size_t i = 0, j = size - 1; i < size; i++, j--)
+        {
+            divideDoubleWord(remainder, a[j], divisor, q, remainder);
+            if(quotient)
+                quotient[j] = q;
+        }
+        return remainder;
+    }
+    size_t shiftCount = countLeadingZeros(divisor);
+    divisor <<= shiftCount;
+    WordType reciprocal = reciprocalWord(divisor);
+    if(shiftCount != 0)
+        remainder = a[size - 1] >> (BitsPerWord - shiftCount);
+    // divide a * 2 ^ shiftCount, shifting each word as it is reached since quotient may overwrite a
+    for(size_t i = 0, j = size - 1; i < size; i++, j--)
     {
-        WordType prod_low;
-        multiplyDoubleWordAndAdd(y, x[j], carry, carry, prod_low);
-        WordType x_j = dest[offset + j];
-        prod_low = x_j - prod_low;
-        if (prod_low > x_j)
-            carry++;
-        dest[offset + j] = prod_low;
+        WordType word = a[j] << shiftCount;
+        if(shiftCount != 0 && j > 0)
+            word |= a[j - 1] >> (BitsPerWord - shiftCount);
+        divideDoubleWordByReciprocal(remainder, word, divisor, reciprocal, q, remainder);
+        if(quotient)
+            quotient[j] = q;
     }
-    while (++j < len);
-    return carry;
+    return remainder >> shiftCount;
 }
 
 
@@ -463,6 +1071,8 @@ static void divide(WordType zds[], size_t nx, const WordType y[], size_t ny)
     // Could be re-implemented using gmp's mpn_divrem:
     // zds[nx] = mpn_divrem (&zds[ny], 0, zds, nx, y, ny).
 
+    // every quotient word estimate divides by the same top word
+    WordType reciprocal = reciprocalWord(y[ny - 1]);
     size_t j = nx;
     do
     {                          // loop over digits of quotient
@@ -474,11 +1084,11 @@ static void divide(WordType zds[], size_t nx, const WordType y[], size_t ny)
         else
         {
             WordType remainder;
-            divideDoubleWord(zds[j], zds[j - 1], y[ny - 1], qhat, remainder);
+            divideDoubleWordByReciprocal(zds[j], zds[j - 1], y[ny - 1], reciprocal, qhat, remainder);
         }
         if(qhat != 0)
         {
-            WordType borrow = submul_1(zds, j - ny, y, ny, qhat);
+            WordType borrow = submul_1(zds + j - ny, y, ny, qhat);
             WordType save = zds[j];
             if(save != borrow)
             {
@@ -502,7 +1112,38 @@ static void divide(WordType zds[], size_t nx, const WordType y[], size_t ny)
     while (--j >= ny);
 }
 
-void BigUnsigned::divMod(BigUnsigned dividend, BigUnsigned divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
+size_t divideScratchSize(size_t aSize, size_t bSize)
+{
+    return aSize + 2 + bSize;
+}
+
+void divideWords(WordType quotient[], WordType remainder[], const WordType a[], size_t aSize, const WordType b[], size_t bSize, WordType scratch[])
+{
+    if(bSize == 1)
+    {
+        WordType r = divideWordsByWord(quotient, a, aSize, b[0]);
+        if(remainder)
+            remainder[0] = r;
+        return;
+    }
+    WordType * x = scratch;
+    WordType * y = x + aSize + 2;
+    size_t normalizationShift = countLeadingZeros(b[bSize - 1]);
+    x[aSize] = normalizationShift == 0 ? 0 : a[aSize - 1] >> (BitsPerWord - normalizationShift);
+    x[aSize + 1] = 0;
+    lshiftWords(x, a, aSize, normalizationShift);
+    lshiftWords(y, b, bSize, normalizationShift);
+    divide(x, aSize + 1, y, bSize);
+    if(remainder)
+        rshiftWords(remainder, x, bSize, normalizationShift);
+    if(quotient)
+    {
+        for(size_t i = 0; i <= aSize - bSize; i++)
+            quotient[i] = x[bSize + i];
+    }
+}
+
+void BigUnsigned::divMod(const BigUnsigned & dividend, const BigUnsigned & divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
 {
     if(dividend.data->size == 1 && divisor.data->size == 1)
     {
@@ -519,85 +1160,87 @@ void BigUnsigned::divMod(BigUnsigned dividend, BigUnsigned divisor, BigUnsigned
         divMod(dividend, divisor.data->words[0], pquotient, premainder);
         return;
     }
-    if(dividend < divisor)
+    BigUnsigned quotient, remainder;
+    divModInto(pquotient ? *pquotient : quotient, premainder ? *premainder : remainder, dividend, divisor);
+}
+
+void divModInto(BigUnsigned & quotient, BigUnsigned & remainder, const BigUnsigned & dividend, const BigUnsigned & divisor)
+{
+    if(&quotient == &remainder)
+        handleError("quotient and remainder are the same in divModInto");
+    if(divisor.data->size == 1)
     {
-        if(pquotient)
-            *pquotient = 0;
-        if(premainder)
-            *premainder = dividend;
+        WordType wordRemainder;
+        divModInto(quotient, wordRemainder, dividend, divisor.data->words[0]);
+        remainder = wordRemainder;
         return;
     }
-    if(dividend == divisor)
+    if(dividend < divisor)
     {
-        if(pquotient)
-            *pquotient = 1;
-        if(premainder)
-            *premainder = 0;
+        profileBigMathOperation(BigMathDivide);
+        remainder = dividend;
+        quotient = 0;
         return;
     }
-    size_t normalizationShift = countLeadingZeros(divisor.data->words[divisor.data->size - 1]);
-    dividend.onWrite();
-    if(normalizationShift != 0)
-    {
-        dividend.data->expand(dividend.data->size + 2);
-        lshiftWords(dividend.data->words, dividend.data->words, dividend.data->size - 1, normalizationShift);
-        divisor.onWrite();
-        lshiftWords(divisor.data->words, divisor.data->words, divisor.data->size, normalizationShift);
-    }
-    else if(dividend.data->size == divisor.data->size)
+    if(&remainder == &dividend || &remainder == &divisor || &quotient == &divisor)
     {
-        dividend.data->expand(dividend.data->size + 2);
-    }
-    else
-    {
-        dividend.data->expand(dividend.data->size + 1);
-    }
-    divide(dividend.data->words, dividend.data->size - 1, divisor.data->words, divisor.data->size);
-    size_t remainderSize = divisor.data->size;
-    size_t quotientSize = dividend.data->size - divisor.data->size;
-    if(premainder)
-    {
-        BigUnsigned & remainder = *premainder;
-        remainder.onWrite();
-        remainder.data->resize(remainderSize);
-        rshiftWords(remainder.data->words, dividend.data->words, remainderSize, normalizationShift);
-        remainder.normalize();
-    }
-    if(pquotient)
-    {
-        BigUnsigned & quotient = *pquotient;
-        quotient.onWrite();
-        quotient.data->resize(quotientSize);
-        for(size_t i = 0; i < quotientSize; i++)
-        {
-            quotient.data->words[i] = dividend.data->words[i + divisor.data->size];
-        }
+        BigUnsigned q, r;
+        divModInto(q, r, dividend, divisor);
+        quotient.swap(q);
+        remainder.swap(r);
+        return;
     }
+    profileBigMathOperation(BigMathDivide);
+    // the remainder's words are the division's scratch space. quotient may be dividend :
+    // shrinking it doesn't move its words and divideWords reads all of them before writing the quotient
+    size_t dividendSize = dividend.data->size, divisorSize = divisor.data->size;
+    size_t scratchSize = divideScratchSize(dividendSize, divisorSize);
+    remainder.onWrite(scratchSize);
+    remainder.data->resize(scratchSize);
+    quotient.onWrite(dividendSize - divisorSize + 1);
+    quotient.data->resize(dividendSize - divisorSize + 1);
+    divideWords(quotient.data->words, remainder.data->words, dividend.data->words, dividendSize, divisor.data->words, divisorSize, remainder.data->words);
+    remainder.data->size = divisorSize;
+    remainder.normalize();
+    quotient.normalize();
+}
+
+void divModInto(BigUnsigned & quotient, WordType & remainder, const BigUnsigned & dividend, WordType divisor)
+{
+    profileBigMathOperation(BigMathDivide);
+    if(divisor == 0)
+        handleError("division by 0 in divModInto");
+    size_t size = dividend.data->size;
+    quotient.onWrite(size);
+    quotient.data->resize(size);
+    divideWords(quotient.data->words, &remainder, dividend.data->words, size, &divisor, 1, NULL);
+    quotient.normalize();
 }
 
-void BigUnsigned::divMod(WordType dividend, BigUnsigned divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
+void BigUnsigned::divMod(WordType dividend, const BigUnsigned & divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
 {
     if(divisor.data->size == 1)
     {
         ::divMod(dividend, divisor.data->words[0], pquotient, premainder);
         return;
     }
+    profileBigMathOperation(BigMathDivide);
     if(pquotient)
         *pquotient = 0;
     if(premainder)
         *premainder = dividend;
 }
 
-void BigUnsigned::divMod(BigUnsigned dividend, WordType divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
+void BigUnsigned::divMod(const BigUnsigned & dividend, WordType divisor, BigUnsigned * pquotient, BigUnsigned * premainder)
 {
     if(divisor == 0)
         handleError("division by 0 in BigUnsigned::divMod");
     if(divisor == 1)
     {
-        if(premainder)
-            *premainder = 0;
         if(pquotient)
             *pquotient = dividend;
+        if(premainder)
+            *premainder = 0;
         return;
     }
     if(dividend.data->size == 1)
@@ -610,6 +1253,7 @@ void BigUnsigned::divMod(BigUnsigned dividend, WordType divisor, BigUnsigned * p
         WordType highWord = dividend.data->words[1];
         if(highWord < divisor)
         {
+            profileBigMathOperation(BigMathDivide);
             WordType lowWord = dividend.data->words[0];
             WordType quotient;
             WordType remainder;
@@ -623,88 +1267,343 @@ void BigUnsigned::divMod(BigUnsigned dividend, WordType divisor, BigUnsigned * p
     }
     if(!pquotient)
     {
-        WordType remainder = 0, quotient;
-        for(size_t i = 0, j = dividend.data->size - 1; i < dividend.data->size; i++, j--)
-        {
-            divideDoubleWord(remainder, dividend.data->words[j], divisor, quotient, remainder);
-        }
+        profileBigMathOperation(BigMathDivide);
+        WordType remainder = divideWordsByWord(NULL, dividend.data->words, dividend.data->size, divisor);
         if(premainder)
             *premainder = remainder;
         return;
     }
-    BigUnsigned & quotient = *pquotient;
-    quotient.onWrite();
-    quotient.data->expand(dividend.data->size);
-    WordType remainder = 0;
-    for(size_t i = 0, j = dividend.data->size - 1; i < dividend.data->size; i++, j--)
-    {
-        divideDoubleWord(remainder, dividend.data->words[j], divisor, quotient.data->words[j], remainder);
-    }
+    WordType remainder;
+    divModInto(*pquotient, remainder, dividend, divisor);
     if(premainder)
         *premainder = remainder;
-    quotient.normalize();
+}
+
+/** the BitsPerWord bits of words[0:size-1] starting at bitIndex, with 0s above the top word */
+static WordType getWordAtBit(const WordType words[], size_t size, size_t bitIndex)
+{
+    size_t wordIndex = bitIndex / BitsPerWord;
+    size_t shiftCount = bitIndex % BitsPerWord;
+    WordType highWord = wordIndex + 1 < size ? words[wordIndex + 1] : 0;
+    WordType lowWord = wordIndex < size ? words[wordIndex] : 0;
+    WordType retval;
+    rshiftDoubleWord(highWord, lowWord, shiftCount, retval);
+    return retval;
+}
+
+/** dest[0:size-1] = x * xFactor - y * yFactor, for a difference that is known to fit */
+static void combineWords(WordType dest[], const WordType x[], WordType xFactor, const WordType y[], WordType yFactor, size_t size)
+{
+    WordType xCarry = 0, yCarry = 0;
+    bool borrow = false;
+    for(size_t i = 0; i < size; i++)
+    {
+        WordType xWord, yWord;
+        multiplyDoubleWordAndAdd(x[i], xFactor, xCarry, xCarry, xWord);
+        multiplyDoubleWordAndAdd(y[i], yFactor, yCarry, yCarry, yWord);
+        subtractWithBorrow(xWord, yWord, borrow, dest[i], borrow);
+    }
+}
+
+static size_t bitLengthWords(const WordType words[], size_t size) // for a nonzero top word
+{
+    return size * BitsPerWord - countLeadingZeros(words[size - 1]);
+}
+
+static size_t normalizedSize(const WordType words[], size_t size)
+{
+    while(size > 1 && words[size - 1] == 0)
+        size--;
+    return size;
+}
+
+/** Knuth's algorithm L. a and b live in word buffers of the larger operand's size and
+  * each pass runs Euclid's algorithm on their top LehmerBits bits, in int64_t, for as long as the
+  * quotients are certain. The cofactors then replace (a, b) with (A * a + B * b, C * a + D * b)
+  * in one pass over the words. When the top bits give no quotient it takes one full division step.
+  * The coefficient of the original a in the current a is kept for extendedGcd : it alternates in
+  * sign with each Euclid step, so only its magnitude and a sign are stored.
+  */
+const size_t LehmerBits = 32; // for any word size, so the cofactors fit in a word and their products in int64_t
+const int64_t LehmerMask = 0xFFFFFFFF;
+
+BigUnsigned BigUnsigned::lehmerGcd(const BigUnsigned & aIn, const BigUnsigned & bIn, BigUnsigned * pcoefficient)
+{
+    profileBigMathOperation(BigMathGcd);
+    if(aIn == (WordType)0 || bIn == (WordType)0)
+    {
+        if(pcoefficient)
+            *pcoefficient = 0;
+        return 0;
+    }
+    size_t size = max(aIn.data->size, bIn.data->size);
+    BigUnsigned scratch(0, 4 * size + divideScratchSize(size, size));
+    WordType * a = scratch.data->words;
+    WordType * b = a + size;
+    WordType * nextA = b + size; // also the quotient of full division steps
+    WordType * nextB = nextA + size;
+    WordType * divideScratch = nextB + size;
+    size_t aSize = aIn.data->size, bSize = bIn.data->size;
+    for(size_t i = 0; i < aSize; i++)
+        a[i] = aIn.data->words[i];
+    for(size_t i = 0; i < bSize; i++)
+        b[i] = bIn.data->words[i];
+    // words above a value's size are kept 0
+    BigUnsigned s0(1), s1(0), t, u, v;
+    bool s0Negative = false; // s1 always has the opposite sign
+    while(bSize > 1 || b[0] != 0)
+    {
+        if(aSize == 1 && bSize == 1 && !pcoefficient)
+        {
+            WordType x = a[0], y = b[0];
+            while(y != 0)
+            {
+                WordType r = x % y;
+                x = y;
+                y = r;
+            }
+            a[0] = x;
+            break;
+        }
+        int64_t A = 1, B = 0, C = 0, D = 1;
+        size_t stepCount = 0;
+        if(bSize > 1 && (aSize > bSize || (aSize == bSize && compareWords(a, b, aSize) >= 0))) // b's top bits must fit where a's are taken
+        {
+            size_t bitIndex = bitLengthWords(a, aSize) - LehmerBits;
+            int64_t aHat = getWordAtBit(a, aSize, bitIndex) & LehmerMask, bHat = getWordAtBit(b, bSize, bitIndex) & LehmerMask;
+            while(bHat + C != 0 && bHat + D != 0)
+            {
+                int64_t q = (aHat + A) / (bHat + C);
+                if(q != (aHat + B) / (bHat + D))
+                    break;
+                int64_t temp = A - q * C;
+                A = C;
+                C = temp;
+                temp = B - q * D;
+                B = D;
+                D = temp;
+                temp = aHat - q * bHat;
+                aHat = bHat;
+                bHat = temp;
+                stepCount++;
+            }
+            if(max(max(A < 0 ? -A : A, B < 0 ? -B : B), max(C < 0 ? -C : C, D < 0 ? -D : D)) > LehmerMask)
+                B = 0;
+        }
+        if(B != 0)
+        {
+            // A and D have the sign of (-1) ^ stepCount, B and C the other one
+            bool even = (stepCount % 2 == 0);
+            WordType absA = (WordType)(A < 0 ? -A : A), absB = (WordType)(B < 0 ? -B : B);
+            WordType absC = (WordType)(C < 0 ? -C : C), absD = (WordType)(D < 0 ? -D : D);
+            if(even)
+            {
+                combineWords(nextA, a, absA, b, absB, aSize);
+                combineWords(nextB, b, absD, a, absC, aSize);
+            }
+            else
+            {
+                combineWords(nextA, b, absB, a, absA, aSize);
+                combineWords(nextB, a, absC, b, absD, aSize);
+            }
+            if(pcoefficient)
+            {
+                // A * s0 and B * s1 have the same sign, and so do C * s0 and D * s1
+                mulAdd(t, s0, absA, 0);
+                mulAdd(u, s1, absB, 0);
+                t += u;
+                mulAdd(u, s0, absC, 0);
+                mulAdd(v, s1, absD, 0);
+                u += v;
+                s0.swap(t);
+                s1.swap(u);
+                if(!even)
+                    s0Negative = !s0Negative;
+            }
+            bSize = normalizedSize(nextB, aSize);
+            aSize = normalizedSize(nextA, aSize);
+        }
+        else
+        {
+            // (a, b) = (b, a % b), with the quotient in nextA
+            size_t quotientSize = 1, remainderSize = aSize;
+            if(aSize < bSize || (aSize == bSize && compareWords(a, b, aSize) < 0))
+            {
+                nextA[0] = 0;
+                for(size_t i = 0; i < aSize; i++)
+                    nextB[i] = a[i];
+            }
+            else
+            {
+                quotientSize = aSize - bSize + 1;
+                remainderSize = bSize;
+                divideWords(nextA, nextB, a, aSize, b, bSize, divideScratch);
+            }
+            if(pcoefficient)
+            {
+                // s2 = s0 - q * s1, and s0 and s1 have opposite signs
+                mulAdd(t, s1, BigUnsigned::fromWords(nextA, quotientSize), s0);
+                s0.swap(s1);
+                s1.swap(t);
+                s0Negative = !s0Negative;
+            }
+            for(size_t i = 0; i < size; i++)
+                nextA[i] = b[i];
+            aSize = bSize;
+            bSize = normalizedSize(nextB, remainderSize);
+        }
+        std::swap(a, nextA);
+        std::swap(b, nextB);
+        for(size_t i = aSize; i < size; i++)
+            a[i] = 0;
+        for(size_t i = bSize; i < size; i++)
+            b[i] = 0;
+    }
+    BigUnsigned retval = BigUnsigned::fromWords(a, aSize);
+    if(pcoefficient)
+    {
+        BigUnsigned m = bIn / retval;
+        BigUnsigned x = s0 % m;
+        if(s0Negative && x != (WordType)0)
+            x = m - x;
+        if(x == (WordType)0)
+            x = m;
+        pcoefficient->swap(x);
+    }
+    return retval;
+}
+
+BigUnsigned extendedGcd(const BigUnsigned & a, const BigUnsigned & b, BigUnsigned & x, BigUnsigned & y)
+{
+    BigUnsigned coefficient;
+    BigUnsigned retval = BigUnsigned::lehmerGcd(a, b, &coefficient);
+    if(retval == (WordType)0)
+    {
+        x = 0;
+        y = 0;
+        return retval;
+    }
+    BigUnsigned product = a * coefficient;
+    product -= retval;
+    y = product / b;
+    x.swap(coefficient);
+    return retval;
+}
+
+BigUnsigned modInverse(const BigUnsigned & a, const BigUnsigned & modulus)
+{
+    if(modulus == (WordType)0)
+        handleError("division by 0 in modInverse");
+    if(modulus == (WordType)1)
+        return 0;
+    BigUnsigned coefficient;
+    if(BigUnsigned::lehmerGcd(a % modulus, modulus, &coefficient) != (WordType)1)
+        handleError("no inverse in modInverse");
+    return coefficient;
 }
 
 const BigUnsigned & BigUnsigned::operator <<=(size_t shiftCount)
 {
-    if(shiftCount == 0)
-        return *this;
-    if(data->size == 1 && data->words[0] == 0)
-        return *this;
-    onWrite();
-    if(data->size == 1 && shiftCount < BitsPerWord && (data->words[0] >> (BitsPerWord - shiftCount)) == 0)
+    shiftLeftInto(*this, *this, shiftCount);
+    return *this;
+}
+
+const BigUnsigned & BigUnsigned::operator >>=(size_t shiftCount)
+{
+    shiftRightInto(*this, *this, shiftCount);
+    return *this;
+}
+
+void shiftLeftInto(BigUnsigned & dst, const BigUnsigned & src, size_t shiftCount)
+{
+    profileBigMathOperation(BigMathShift);
+    if(!src)
     {
-        data->words[0] <<= shiftCount;
-        return *this;
+        dst = 0;
+        return;
     }
     size_t wordCount = shiftCount / BitsPerWord;
     shiftCount %= BitsPerWord;
-    size_t shiftSize = data->size;
-    size_t newSize = data->size + wordCount;
-    WordType topWord = data->words[data->size - 1] >> (BitsPerWord - shiftCount);
-    if(topWord != 0)
-        newSize++;
-    data->expand(newSize);
-    if(topWord != 0)
-        data->words[shiftSize] = topWord;
-    WordType * temp = new WordType[shiftSize];
-    for(size_t i = 0; i < shiftSize; i++)
-        temp[i] = data->words[i];
-    lshiftWords(data->words + wordCount, temp, shiftSize, shiftCount);
-    delete []temp;
+    const BigUnsigned::Data * source = src.data;
+    size_t sourceSize = source->size;
+    size_t size = sourceSize + wordCount + 1;
+    dst.onWrite(size);
+    dst.data->resize(size);
+    WordType * d = dst.data->words;
+    const WordType * s = source->words;
+    // from the top down so it works in place
+    d[sourceSize + wordCount] = shiftCount == 0 ? 0 : s[sourceSize - 1] >> (BitsPerWord - shiftCount);
+    for(size_t i = sourceSize; i > 0; i--)
+    {
+        WordType word = s[i - 1] << shiftCount;
+        if(shiftCount != 0 && i > 1)
+            word |= s[i - 2] >> (BitsPerWord - shiftCount);
+        d[i - 1 + wordCount] = word;
+    }
     for(size_t i = 0; i < wordCount; i++)
+        d[i] = 0;
+    dst.normalize();
+}
+
+void shiftRightInto(BigUnsigned & dst, const BigUnsigned & src, size_t shiftCount)
+{
+    profileBigMathOperation(BigMathShift);
+    size_t wordCount = shiftCount / BitsPerWord;
+    shiftCount %= BitsPerWord;
+    const BigUnsigned::Data * source = src.data;
+    size_t sourceSize = source->size;
+    if(sourceSize <= wordCount)
     {
-        data->words[i] = 0;
+        dst = 0;
+        return;
     }
-    return *this;
+    size_t size = sourceSize - wordCount;
+    dst.onWrite(size);
+    dst.data->resize(size);
+    WordType * d = dst.data->words;
+    const WordType * s = source->words;
+    for(size_t i = 0; i < size; i++)
+        d[i] = s[i + wordCount];
+    rshiftWords(d, d, size, shiftCount);
+    dst.normalize();
 }
 
-const BigUnsigned & BigUnsigned::operator >>=(size_t shiftCount)
+void addShifted(BigUnsigned & dst, const BigUnsigned & b, size_t shiftCount)
 {
-    if(shiftCount == 0)
-        return *this;
-    if(data->size == 1 && data->words[0] == 0)
-        return *this;
+    if(!b)
+        return;
+    if(&dst == &b)
+    {
+        BigUnsigned shifted;
+        shiftLeftInto(shifted, b, shiftCount);
+        dst += shifted;
+        return;
+    }
+    profileBigMathOperation(BigMathAdd);
     size_t wordCount = shiftCount / BitsPerWord;
     shiftCount %= BitsPerWord;
-    if(data->size <= wordCount)
+    const BigUnsigned::Data * source = b.data;
+    size_t shiftedSize = source->size + (shiftCount != 0 ? 1 : 0);
+    size_t size = max(dst.data->size, wordCount + shiftedSize) + 1;
+    dst.onWrite(size);
+    dst.data->expand(size);
+    WordType * d = dst.data->words + wordCount;
+    bool carry = false;
+    WordType lastWord = 0;
+    for(size_t i = 0; i < shiftedSize; i++)
     {
-        return operator =(0);
+        WordType word = i < source->size ? source->words[i] : 0;
+        WordType shifted = word;
+        if(shiftCount != 0)
+            lshiftDoubleWord(word, lastWord, shiftCount, shifted);
+        lastWord = word;
+        addWithCarry(d[i], shifted, carry, d[i], carry);
     }
-    if(data->size == 1 + wordCount)
+    for(size_t i = shiftedSize; carry; i++)
     {
-        return operator =(data->words[wordCount] >> shiftCount);
+        carry = (++d[i] == 0);
     }
-    onWrite();
-    size_t shiftSize = data->size - wordCount;
-    WordType * temp = new WordType[shiftSize];
-    for(size_t i = 0; i < shiftSize; i++)
-        temp[i] = data->words[i + wordCount];
-    rshiftWords(data->words, temp, shiftSize, shiftCount);
-    delete []temp;
-    data->size = shiftSize;
-    normalize();
-    return *this;
+    dst.normalize();
 }
 
 static WordType getCharacterValue(char ch)
@@ -725,65 +1624,222 @@ static char getCharacter(WordType v)
     return (char)(v - 10) + 'A';
 }
 
+/** the bitCount < BitsPerWord bits of words[0:size-1] starting at bitIndex, in the low bits */
+static WordType getBits(const WordType words[], size_t size, size_t bitIndex, size_t bitCount)
+{
+    size_t wordIndex = bitIndex / BitsPerWord;
+    size_t shiftCount = bitIndex % BitsPerWord;
+    WordType retval = words[wordIndex] >> shiftCount;
+    if(shiftCount + bitCount > BitsPerWord && wordIndex + 1 < size)
+        retval |= words[wordIndex + 1] << (BitsPerWord - shiftCount);
+    return retval & (((WordType)1 << bitCount) - 1);
+}
+
+/** OR the low bitCount bits of v into words at bitIndex. */
+static void setBits(WordType words[], size_t bitIndex, size_t bitCount, WordType v)
+{
+    size_t wordIndex = bitIndex / BitsPerWord;
+    size_t shiftCount = bitIndex % BitsPerWord;
+    words[wordIndex] |= v << shiftCount;
+    if(shiftCount + bitCount > BitsPerWord)
+        words[wordIndex + 1] |= v >> (BitsPerWord - shiftCount);
+}
+
+/** the number of bits in a digit for bases 2, 4, 8, 16 and 32, or 0 for other bases */
+static size_t getDigitBits(unsigned base)
+{
+    size_t retval = 0;
+    while(((unsigned)1 << retval) < base)
+        retval++;
+    return ((unsigned)1 << retval) == base ? retval : 0;
+}
+
+/** the largest power of base that fits in a word, base ^ blockDigits */
+static void getBlockPower(unsigned base, WordType & blockPower, size_t & blockDigits)
+{
+    blockPower = base;
+    blockDigits = 1;
+    while(blockPower < WordMax / base)
+    {
+        blockPower *= base;
+        blockDigits++;
+    }
+}
+
+// numbers up to this many words are converted a word sized block of digits at a time, larger ones are split in half
+const size_t RadixSplitWords = 24;
+
+/** powers of a base for splitting numbers in half : level k is base ^ (blockDigits * 2 ^ k).
+  * They are built on first use and kept for later conversions in the same base.
+  */
+struct RadixPowers
+{
+    vector<BigUnsigned> powers;
+    vector<BarrettReducer> reducers; // only toString divides by the powers
+};
+
+static RadixPowers radixPowers[37];
+
+static const vector<BigUnsigned> & getRadixPowers(unsigned base, size_t levelCount)
+{
+    ScopedBigMathAllocator heap(NULL); // the cache outlives any arena
+    vector<BigUnsigned> & powers = radixPowers[base].powers;
+    if(powers.empty())
+    {
+        WordType blockPower;
+        size_t blockDigits;
+        getBlockPower(base, blockPower, blockDigits);
+        powers.push_back(BigUnsigned(blockPower));
+    }
+    while(powers.size() < levelCount)
+        powers.push_back(square(powers.back()));
+    return powers;
+}
+
+static const vector<BarrettReducer> & getRadixReducers(unsigned base, size_t levelCount)
+{
+    const vector<BigUnsigned> & powers = getRadixPowers(base, levelCount);
+    vector<BarrettReducer> & reducers = radixPowers[base].reducers;
+    ScopedBigMathAllocator heap(NULL);
+    while(reducers.size() < levelCount)
+        reducers.push_back(BarrettReducer(powers[reducers.size()]));
+    return reducers;
+}
+
+/** append v's digits, at least minimumDigits of them, dividing by base ^ blockDigits one word at a time */
+static void appendDigitsByWord(string & dest, BigUnsigned v, unsigned base, WordType blockPower, size_t blockDigits, size_t minimumDigits)
+{
+    size_t start = dest.size();
+    WordType currentBlock;
+    while(v >= blockPower)
+    {
+        divModInto(v, currentBlock, v, blockPower);
+        for(size_t i = 0; i < blockDigits; i++)
+        {
+            dest.push_back(getCharacter(currentBlock % base));
+            currentBlock /= base;
+        }
+    }
+    for(currentBlock = (WordType)v; currentBlock != 0; currentBlock /= base)
+        dest.push_back(getCharacter(currentBlock % base));
+    while(dest.size() - start < minimumDigits)
+        dest.push_back('0');
+    reverse(dest.begin() + start, dest.end());
+}
+
+/** append the digits of v < reducers[level].getModulus() ^ 2, splitting it in half by that power.
+  * With pad, exactly 2 * (blockDigits << level) digits are written.
+  */
+static void appendDigitsBySplitting(string & dest, const BigUnsigned & v, unsigned base, WordType blockPower, size_t blockDigits, const vector<BarrettReducer> & reducers, size_t level, bool pad)
+{
+    // level 0's square fits in 2 words, so the recursion ends before level goes below 0
+    if(v.getWordCount() <= RadixSplitWords)
+    {
+        appendDigitsByWord(dest, v, base, blockPower, blockDigits, pad ? 2 * (blockDigits << level) : 1);
+        return;
+    }
+    const BarrettReducer & reducer = reducers[level];
+    if(!pad && v < reducer.getModulus())
+    {
+        appendDigitsBySplitting(dest, v, base, blockPower, blockDigits, reducers, level - 1, false);
+        return;
+    }
+    BigUnsigned quotient, remainder;
+    reducer.divMod(v, quotient, remainder);
+    appendDigitsBySplitting(dest, quotient, base, blockPower, blockDigits, reducers, level - 1, pad);
+    appendDigitsBySplitting(dest, remainder, base, blockPower, blockDigits, reducers, level - 1, true);
+}
+
+/** parse str[start:end-1], whose digits have been checked, splitting it in half by a power of the base */
+static BigUnsigned parseDigits(const string & str, size_t start, size_t end, unsigned base, size_t blockDigits)
+{
+    size_t digitCount = end - start;
+    if(digitCount <= RadixSplitWords * blockDigits)
+    {
+        BigUnsigned retval(0);
+        for(size_t i = start; i < end;)
+        {
+            WordType currentBlock = 0, blockPower = 1;
+            for(size_t j = 0; j < blockDigits && i < end; j++, i++)
+            {
+                currentBlock = currentBlock * base + getCharacterValue(str[i]);
+                blockPower *= base;
+            }
+            mulAdd(retval, retval, blockPower, currentBlock);
+        }
+        return retval;
+    }
+    size_t level = 0;
+    while((blockDigits << (level + 1)) < digitCount)
+        level++;
+    size_t lowDigitCount = blockDigits << level;
+    const BigUnsigned & power = getRadixPowers(base, level + 1)[level]; // the recursion only uses lower levels, so this stays put
+    BigUnsigned high = parseDigits(str, start, end - lowDigitCount, base, blockDigits);
+    BigUnsigned low = parseDigits(str, end - lowDigitCount, end, base, blockDigits);
+    BigUnsigned retval;
+    mulAdd(retval, high, power, low);
+    return retval;
+}
+
 BigUnsigned BigUnsigned::parse(string str, unsigned base)
 {
+    profileBigMathOperation(BigMathConvert);
     if(base < 2 || base > 36)
         handleError("invalid base in BigUnsigned::parse");
-    BigUnsigned retval(0);
     for(size_t i = 0; i < str.size(); i++)
     {
-        WordType digit = getCharacterValue(str[i]);
-        if(digit >= base)
+        if(getCharacterValue(str[i]) >= base)
             handleError("invalid character in BigUnsigned::parse");
-        retval *= (WordType)base;
-        retval += digit;
     }
+    size_t digitBits = getDigitBits(base);
+    if(digitBits == 0)
+    {
+        WordType blockPower;
+        size_t blockDigits;
+        getBlockPower(base, blockPower, blockDigits);
+        return parseDigits(str, 0, str.size(), base, blockDigits);
+    }
+    BigUnsigned retval(0, max((digitBits * str.size() + BitsPerWord - 1) / BitsPerWord, (size_t)1));
+    for(size_t i = 0, j = str.size(); j > 0; i++, j--)
+    {
+        setBits(retval.data->words, digitBits * i, digitBits, getCharacterValue(str[j - 1]));
+    }
+    retval.normalize();
     return retval;
 }
 
 string BigUnsigned::toString(unsigned base) const
 {
+    profileBigMathOperation(BigMathConvert);
     if(base < 2 || base > 36)
         handleError("invalid base in BigUnsigned::toString");
-    WordType basePower = base;
-    size_t digitCount = 1;
-    while(basePower < WordMax / base)
-    {
-        basePower *= base;
-        digitCount++;
-    }
     string retval;
-    retval.reserve((digitCount + 1) * data->size);
-    BigUnsigned v = *this;
-    BigUnsigned remainder;
-    WordType currentBlock;
-    while(v >= basePower)
+    size_t digitBits = getDigitBits(base);
+    if(digitBits != 0)
     {
-        divMod(v, basePower, v, remainder);
-        currentBlock = (WordType)remainder;
-        for(size_t i = 0; i < digitCount; i++)
+        size_t digitCount = max((bitLength() + digitBits - 1) / digitBits, (size_t)1);
+        retval.resize(digitCount);
+        for(size_t i = 0, j = digitCount; j > 0; i++, j--)
         {
-            WordType digit = currentBlock % base;
-            currentBlock /= base;
-            retval.push_back(getCharacter(digit));
+            retval[i] = getCharacter(getBits(data->words, data->size, digitBits * (j - 1), digitBits));
         }
+        return retval;
     }
-    currentBlock = (WordType)v;
-    while(currentBlock != 0)
-    {
-        WordType digit = currentBlock % base;
-        currentBlock /= base;
-        retval.push_back(getCharacter(digit));
-    }
-    if(retval.size() >= 2)
+    WordType blockPower;
+    size_t blockDigits;
+    getBlockPower(base, blockPower, blockDigits);
+    retval.reserve((blockDigits + 1) * data->size);
+    if(data->size <= RadixSplitWords)
     {
-        for(size_t i = 0, j = retval.size() - 1; j > i; j--, i++)
-        {
-            std::swap(retval[i], retval[j]);
-        }
+        appendDigitsByWord(retval, *this, base, blockPower, blockDigits, 1);
+        return retval;
     }
-    if(retval == "")
-        retval = "0";
+    // the top level's power has to be above the square root of the number
+    size_t levelCount = 1;
+    while(2 * getRadixPowers(base, levelCount)[levelCount - 1].bitLength() - 1 <= bitLength())
+        levelCount++;
+    const vector<BarrettReducer> & reducers = getRadixReducers(base, levelCount);
+    appendDigitsBySplitting(retval, *this, base, blockPower, blockDigits, reducers, levelCount - 1, false);
     return retval;
 }
 
@@ -817,37 +1873,529 @@ static WordType getBase64Value(char ch)
     return WordMax;
 }
 
+// base64 digits are converted 4 at a time, as one 24 bit group
+const size_t Base64GroupDigits = 4;
+const size_t Base64GroupBits = 6 * Base64GroupDigits;
+
 BigUnsigned BigUnsigned::parseBase64(string str)
 {
-    while(str.size() > 0 && str[str.size() - 1] == '=')
-        str.erase(str.size() - 1);
-    BigUnsigned retval(0);
-    for(size_t i = 0; i < str.size(); i++)
+    profileBigMathOperation(BigMathConvert);
+    size_t digitCount = str.size();
+    while(digitCount > 0 && str[digitCount - 1] == '=')
+        digitCount--;
+    size_t wordCount = max((6 * digitCount + BitsPerWord - 1) / BitsPerWord, (size_t)1);
+    BigUnsigned retval(0, wordCount);
+    WordType * words = retval.data->words;
+    size_t bitIndex = 0;
+    for(size_t end = digitCount; end > 0;) // from the least significant digit
     {
-        WordType v = getBase64Value(str[i]);
-        if(v >= 64)
-            handleError("invalid base64 character");
-        retval <<= 6;
-        retval |= v;
+        size_t start = end > Base64GroupDigits ? end - Base64GroupDigits : 0;
+        WordType group = 0;
+        for(size_t i = start; i < end; i++)
+        {
+            WordType v = getBase64Value(str[i]);
+            if(v >= 64)
+                handleError("invalid base64 character");
+            group = (group << 6) | v;
+        }
+        size_t wordIndex = bitIndex / BitsPerWord;
+        size_t shiftCount = bitIndex % BitsPerWord;
+        words[wordIndex] |= group << shiftCount;
+        if(shiftCount + 6 * (end - start) > BitsPerWord)
+            words[wordIndex + 1] |= group >> (BitsPerWord - shiftCount);
+        bitIndex += 6 * (end - start);
+        end = start;
     }
+    retval.normalize();
     return retval;
 }
 
+void appendBase64Words(string & dest, const WordType words[], size_t size)
+{
+    while(size > 1 && words[size - 1] == 0)
+        size--;
+    size_t bitCount = BitsPerWord * size;
+    for(WordType topWord = words[size - 1]; bitCount > 0 && (topWord & ((WordType)1 << (BitsPerWord - 1))) == 0; topWord <<= 1)
+        bitCount--;
+    size_t digitCount = max((bitCount + 5) / 6, (size_t)1);
+    size_t position = dest.size();
+    dest.resize(position + digitCount);
+    // the most significant group has the 1 to 4 digits left over, the rest have 4
+    size_t groupDigits = (digitCount - 1) % Base64GroupDigits + 1;
+    for(size_t end = digitCount; end > 0; end -= groupDigits, groupDigits = Base64GroupDigits)
+    {
+        size_t bitIndex = 6 * (end - groupDigits);
+        size_t wordIndex = bitIndex / BitsPerWord;
+        size_t shiftCount = bitIndex % BitsPerWord;
+        WordType group = words[wordIndex] >> shiftCount;
+        if(shiftCount + Base64GroupBits > BitsPerWord && wordIndex + 1 < size)
+            group |= words[wordIndex + 1] << (BitsPerWord - shiftCount);
+        for(size_t i = groupDigits; i > 0; i--)
+            dest[position++] = getBase64Character((group >> (6 * (i - 1))) & 0x3F);
+    }
+}
+
 string BigUnsigned::toBase64() const
 {
+    profileBigMathOperation(BigMathConvert);
     string retval;
-    retval.reserve(((BitsPerWord * data->size + 5) / 6));
-    bool first = true;
-    for(BigUnsigned v = *this; v != (WordType)0 || first; v >>= 6, first = false)
+    appendBase64Words(retval, data->words, data->size);
+    return retval;
+}
+ExponentChain::ExponentChain(BigUnsigned exponent)
+    : windowSize(1), trailingSquareCount(0)
+{
+    size_t bitCount = exponent.bitLength();
+    if(bitCount > 671)
+        windowSize = 6;
+    else if(bitCount > 239)
+        windowSize = 5;
+    else if(bitCount > 79)
+        windowSize = 4;
+    else if(bitCount > 23)
+        windowSize = 3;
+    size_t squareCount = 0;
+    for(size_t i = bitCount; i > 0;)
+    {
+        size_t top = i - 1;
+        if(!exponent.getBit(top))
+        {
+            squareCount++;
+            i--;
+            continue;
+        }
+        size_t bottom = top + 1 > windowSize ? top + 1 - windowSize : 0;
+        while(!exponent.getBit(bottom))
+            bottom++;
+        size_t value = 0;
+        for(size_t j = top + 1; j > bottom; j--)
+            value = (value << 1) | (exponent.getBit(j - 1) ? 1 : 0);
+        Step step;
+        step.squareCount = steps.empty() ? 0 : squareCount + top + 1 - bottom;
+        step.tableIndex = value >> 1;
+        steps.push_back(step);
+        squareCount = 0;
+        i = bottom;
+    }
+    trailingSquareCount = squareCount;
+}
+
+BigUnsigned powMod(BigUnsigned base, BigUnsigned exponent, BigUnsigned modulus)
+{
+    if(modulus == (WordType)1)
+        return BigUnsigned(0);
+    if((modulus.data->words[0] & 1) != 0)
+        return powMod(base, ExponentChain(exponent), MontgomeryContext(modulus));
+    return powMod(base, ExponentChain(exponent), BarrettReducer(modulus));
+}
+
+BigUnsigned powMod(BigUnsigned base, const ExponentChain & exponent, const BarrettReducer & reducer)
+{
+    profileBigMathOperation(BigMathPowMod);
+    if(reducer.getModulus() == (WordType)1)
+        return BigUnsigned(0);
+    if(exponent.getStepCount() == 0)
+        return BigUnsigned(1);
+    base = reducer.reduce(base);
+    vector<BigUnsigned> table(exponent.getTableSize());
+    table[0] = base;
+    if(table.size() > 1)
     {
-        retval.push_back(getBase64Character((WordType)(v & (WordType)0x3F)));
+        BigUnsigned baseSquared = reducer.reduce(square(base));
+        for(size_t i = 1; i < table.size(); i++)
+            table[i] = reducer.reduce(table[i - 1] * baseSquared);
     }
-    if(retval.size() >= 2)
+    BigUnsigned retval = table[exponent.getStep(0).tableIndex];
+    for(size_t i = 1; i < exponent.getStepCount(); i++)
     {
-        for(size_t i = 0, j = retval.size() - 1; j > i; j--, i++)
+        const ExponentChain::Step & step = exponent.getStep(i);
+        for(size_t j = 0; j < step.squareCount; j++)
+            retval = reducer.reduce(square(retval));
+        retval = reducer.reduce(retval * table[step.tableIndex]);
+    }
+    for(size_t j = 0; j < exponent.getTrailingSquareCount(); j++)
+        retval = reducer.reduce(square(retval));
+    return retval;
+}
+
+/** Subtract y[0:size-1] from x[0:size-1] in place if x[0:size] >= y. x[size] is the word above x's top word. */
+static void conditionalSubtract(WordType x[], WordType xHighWord, const WordType y[], size_t size)
+{
+    if(xHighWord == 0)
+    {
+        for(size_t i = 0, j = size - 1; i < size; i++, j--)
+        {
+            if(x[j] > y[j])
+                break;
+            if(x[j] < y[j])
+                return;
+        }
+    }
+    bool borrow = false;
+    for(size_t i = 0; i < size; i++)
+    {
+        subtractWithBorrow(x[i], y[i], borrow, x[i], borrow);
+    }
+}
+
+/** Compute result[0:size-1] = t[0:2*size-1] / R mod n[0:size-1]. t[2*size] must be available and t is destroyed. */
+static void montgomeryReduce(WordType result[], WordType t[], const WordType n[], size_t size, WordType inverse)
+{
+    t[2 * size] = 0;
+    for(size_t i = 0; i < size; i++)
+    {
+        WordType m = t[i] * inverse;
+        WordType carry = addmul_1(t + i, n, size, m);
+        for(size_t j = i + size; carry != 0 && j <= 2 * size; j++)
         {
-            std::swap(retval[i], retval[j]);
+            bool overflow;
+            addWithCarry(t[j], carry, false, t[j], overflow);
+            carry = overflow ? 1 : 0;
         }
     }
+    conditionalSubtract(t + size, t[2 * size], n, size);
+    for(size_t i = 0; i < size; i++)
+        result[i] = t[size + i];
+}
+
+/** the number of scratch words the Montgomery multiply and square kernels need */
+static size_t montgomeryScratchSize(size_t size)
+{
+    return 2 * size + 1 + karatsubaScratchSize(size);
+}
+
+/** Compute result[0:size-1] = a * b / R mod n[0:size-1] with the CIOS form of Montgomery's REDC,
+  * or with a Karatsuba product followed by a separate reduction for large moduli.
+  * Each row's reduction is added at the row's offset rather than shifting t down a word, so both halves are addmul_1 rows.
+  * t is scratch space of montgomeryScratchSize(size) words. result may be the same as a or b.
+  */
+static void montgomeryMultiply(WordType result[], const WordType a[], const WordType b[], const WordType n[], size_t size, WordType inverse, WordType t[])
+{
+    if(size >= BigUnsigned::karatsubaThreshold)
+    {
+        karatsubaMultiply(t, a, b, size, t + 2 * size + 1);
+        montgomeryReduce(result, t, n, size, inverse);
+        return;
+    }
+    for(size_t i = 0; i <= 2 * size; i++)
+        t[i] = 0;
+    for(size_t i = 0; i < size; i++)
+    {
+        // t[i+size+1] is still 0 here
+        bool overflow;
+        WordType carry = addmul_1(t + i, a, size, b[i]);
+        addWithCarry(t[i + size], carry, false, t[i + size], overflow);
+        t[i + size + 1] = overflow ? 1 : 0;
+        WordType m = t[i] * inverse;
+        carry = addmul_1(t + i, n, size, m);
+        addWithCarry(t[i + size], carry, false, t[i + size], overflow);
+        t[i + size + 1] += overflow ? 1 : 0;
+    }
+    conditionalSubtract(t + size, t[2 * size], n, size);
+    for(size_t i = 0; i < size; i++)
+        result[i] = t[size + i];
+}
+
+/** Compute result[0:size-1] = a * a / R mod n[0:size-1]. t is scratch space of montgomeryScratchSize(size) words. */
+static void montgomerySquare(WordType result[], const WordType a[], const WordType n[], size_t size, WordType inverse, WordType t[])
+{
+    karatsubaSquare(t, a, size, t + 2 * size + 1);
+    montgomeryReduce(result, t, n, size, inverse);
+}
+
+void MontgomeryContext::initialize()
+{
+    if((modulus.data->words[0] & 1) == 0)
+        handleError("even modulus in MontgomeryContext::MontgomeryContext");
+    if(modulus == (WordType)1)
+        handleError("modulus of 1 in MontgomeryContext::MontgomeryContext");
+    // Newton's iteration : each step doubles the number of correct low bits, and x = n is correct to 3 bits
+    WordType n0 = modulus.data->words[0];
+    WordType x = n0;
+    for(size_t bits = 3; bits < BitsPerWord; bits *= 2)
+    {
+        x *= 2 - n0 * x;
+    }
+    inverse = 0 - x;
+}
+
+MontgomeryContext::MontgomeryContext(BigUnsigned modulus)
+    : modulus(modulus), size(modulus.data->size)
+{
+    initialize();
+    BigUnsigned r(0, size + 1);
+    r.data->words[size] = 1;
+    r %= modulus;
+    rSquared = (r * r) % modulus;
+}
+
+MontgomeryContext::MontgomeryContext(BigUnsigned modulus, BigUnsigned rSquared)
+    : modulus(modulus), rSquared(rSquared), size(modulus.data->size)
+{
+    initialize();
+    if(rSquared >= modulus)
+        handleError("R squared not reduced in MontgomeryContext::MontgomeryContext");
+}
+
+void MontgomeryContext::load(WordType dest[], BigUnsigned v) const
+{
+    if(v >= modulus)
+        v %= modulus;
+    for(size_t i = 0; i < size; i++)
+    {
+        dest[i] = i < v.data->size ? v.data->words[i] : 0;
+    }
+}
+
+BigUnsigned MontgomeryContext::store(const WordType src[]) const
+{
+    BigUnsigned retval(0, size);
+    for(size_t i = 0; i < size; i++)
+    {
+        retval.data->words[i] = src[i];
+    }
+    retval.normalize();
     return retval;
-}
\ No newline at end of file
+}
+
+BigUnsigned MontgomeryContext::toMontgomery(BigUnsigned v) const
+{
+    BigUnsigned scratch(0, 2 * size + montgomeryScratchSize(size));
+    WordType * a = scratch.data->words;
+    WordType * b = a + size;
+    WordType * t = b + size;
+    load(a, v);
+    load(b, rSquared);
+    montgomeryMultiply(a, a, b, modulus.data->words, size, inverse, t);
+    return store(a);
+}
+
+BigUnsigned MontgomeryContext::fromMontgomery(BigUnsigned v) const
+{
+    BigUnsigned scratch(0, 3 * size + 1);
+    WordType * a = scratch.data->words;
+    WordType * t = a + size;
+    load(t, v);
+    for(size_t i = size; i < 2 * size; i++)
+        t[i] = 0;
+    montgomeryReduce(a, t, modulus.data->words, size, inverse);
+    return store(a);
+}
+
+BigUnsigned MontgomeryContext::multiply(BigUnsigned a, BigUnsigned b) const
+{
+    BigUnsigned scratch(0, 2 * size + montgomeryScratchSize(size));
+    WordType * aWords = scratch.data->words;
+    WordType * bWords = aWords + size;
+    WordType * t = bWords + size;
+    load(aWords, a);
+    load(bWords, b);
+    montgomeryMultiply(aWords, aWords, bWords, modulus.data->words, size, inverse, t);
+    return store(aWords);
+}
+
+BigUnsigned MontgomeryContext::square(BigUnsigned a) const
+{
+    BigUnsigned scratch(0, size + montgomeryScratchSize(size));
+    WordType * aWords = scratch.data->words;
+    WordType * t = aWords + size;
+    load(aWords, a);
+    montgomerySquare(aWords, aWords, modulus.data->words, size, inverse, t);
+    return store(aWords);
+}
+
+BigUnsigned powMod(BigUnsigned base, BigUnsigned exponent, const MontgomeryContext & context)
+{
+    return powMod(base, ExponentChain(exponent), context);
+}
+
+BigUnsigned powMod(BigUnsigned base, const ExponentChain & exponent, const MontgomeryContext & context)
+{
+    if(exponent.getStepCount() == 0)
+        return BigUnsigned(1);
+    const size_t size = context.size;
+    if(base.data->size > size)
+        base %= context.modulus;
+    BigUnsigned scratch(0, size + context.getPowModScratchSize(exponent));
+    WordType * result = scratch.data->words;
+    context.powModWords(result, base.data->words, base.data->size, exponent, result + size);
+    return context.store(result);
+}
+
+size_t MontgomeryContext::getPowModScratchSize(const ExponentChain & exponent) const
+{
+    return (exponent.getTableSize() + 1) * size + montgomeryScratchSize(size);
+}
+
+void MontgomeryContext::powModWords(WordType result[], const WordType base[], size_t baseSize, const ExponentChain & exponent, WordType scratch[]) const
+{
+    profileBigMathOperation(BigMathPowMod);
+    if(baseSize > size)
+        handleError("base too large in MontgomeryContext::powModWords");
+    if(exponent.getStepCount() == 0)
+    {
+        for(size_t i = 0; i < size; i++)
+            result[i] = i == 0 ? 1 : 0;
+        return;
+    }
+    const WordType * n = modulus.data->words;
+    const size_t tableSize = exponent.getTableSize();
+    WordType * table = scratch; // odd powers of the base in Montgomery form
+    WordType * temp = table + tableSize * size; // R squared, then the base squared
+    WordType * t = temp + size;
+    for(size_t i = 0; i < size; i++)
+    {
+        table[i] = i < baseSize ? base[i] : 0;
+        temp[i] = i < rSquared.data->size ? rSquared.data->words[i] : 0;
+    }
+    if(compareWords(table, n, size) >= 0)
+    {
+        // base < R, so reducing it gives base / R mod n, and multiplying that by R squared gives base mod n
+        for(size_t i = 0; i < 2 * size; i++)
+            t[i] = i < size ? table[i] : 0;
+        montgomeryReduce(table, t, n, size, inverse);
+        montgomeryMultiply(table, table, temp, n, size, inverse, t);
+    }
+    montgomeryMultiply(table, table, temp, n, size, inverse, t);
+    if(tableSize > 1)
+    {
+        montgomerySquare(temp, table, n, size, inverse, t);
+        for(size_t i = 1; i < tableSize; i++)
+            montgomeryMultiply(table + i * size, table + (i - 1) * size, temp, n, size, inverse, t);
+    }
+    const WordType * first = table + exponent.getStep(0).tableIndex * size;
+    for(size_t i = 0; i < size; i++)
+        result[i] = first[i];
+    for(size_t i = 1; i < exponent.getStepCount(); i++)
+    {
+        const ExponentChain::Step & step = exponent.getStep(i);
+        for(size_t j = 0; j < step.squareCount; j++)
+            montgomerySquare(result, result, n, size, inverse, t);
+        montgomeryMultiply(result, result, table + step.tableIndex * size, n, size, inverse, t);
+    }
+    for(size_t j = 0; j < exponent.getTrailingSquareCount(); j++)
+        montgomerySquare(result, result, n, size, inverse, t);
+    for(size_t i = 0; i < 2 * size; i++)
+        t[i] = i < size ? result[i] : 0;
+    montgomeryReduce(result, t, n, size, inverse);
+}
+
+BarrettReducer::BarrettReducer(BigUnsigned modulus)
+    : modulus(modulus), size(modulus.data->size)
+{
+    if(modulus == (WordType)0)
+        handleError("division by 0 in BarrettReducer::BarrettReducer");
+    BigUnsigned power(0, 2 * size + 1);
+    power.data->words[2 * size] = 1;
+    mu = power / modulus;
+}
+
+BigUnsigned BarrettReducer::reduce(BigUnsigned v) const
+{
+    BigUnsigned retval;
+    divMod(v, NULL, &retval);
+    return retval;
+}
+
+void BarrettReducer::divMod(const BigUnsigned & v, BigUnsigned * pquotient, BigUnsigned * premainder) const
+{
+    if(v < modulus)
+    {
+        if(premainder)
+            *premainder = v;
+        if(pquotient)
+            *pquotient = 0;
+        return;
+    }
+    if(modulus == (WordType)1) // mu would need size + 2 words
+    {
+        if(pquotient)
+            *pquotient = v;
+        if(premainder)
+            *premainder = 0;
+        return;
+    }
+    if(v.data->size > 2 * size)
+    {
+        BigUnsigned quotient, remainder;
+        divModInto(pquotient ? *pquotient : quotient, premainder ? *premainder : remainder, v, modulus);
+        return;
+    }
+    // q = floor(floor(v / B ^ (size - 1)) * mu / B ^ (size + 1)) is at most 2 below floor(v / modulus)
+    const WordType * m = modulus.data->words;
+    BigUnsigned scratch(0, 2 * size + 2 * size + 2 + 2 * size + 1 + size + 1 + multiplyScratchSize(size + 1));
+    WordType * x = scratch.data->words;
+    WordType * product = x + 2 * size;
+    WordType * qm = product + 2 * size + 2;
+    WordType * muWords = qm + 2 * size + 1;
+    WordType * multiplyScratch = muWords + size + 1;
+    WordType * q = product + size + 1;
+    for(size_t i = 0; i < 2 * size; i++)
+        x[i] = i < v.data->size ? v.data->words[i] : 0;
+    for(size_t i = 0; i < size + 1; i++)
+        muWords[i] = i < mu.data->size ? mu.data->words[i] : 0;
+    multiplyLongWords(product, x + size - 1, size + 1, muWords, size + 1, multiplyScratch);
+    multiplyLongWords(qm, q, size + 1, m, size, multiplyScratch);
+    // r = v - q * modulus, computed mod B ^ (size + 1) since it is less than 3 * modulus
+    subtractWords(x, size + 1, qm, size + 1);
+    const WordType one = 1;
+    while(x[size] != 0 || compareWords(x, m, size) >= 0)
+    {
+        subtractWords(x, size + 1, m, size);
+        addWords(q, size + 1, &one, 1);
+    }
+    if(pquotient)
+        *pquotient = BigUnsigned::fromWords(q, size + 1);
+    if(premainder)
+        *premainder = BigUnsigned::fromWords(x, size);
+}
+
+WordBarrettReducer::WordBarrettReducer(WordType modulus)
+    : modulus(modulus), mu(0)
+{
+    if(modulus == 0)
+        handleError("division by 0 in WordBarrettReducer::WordBarrettReducer");
+    if(modulus > 1 && modulus <= ((WordType)1 << (BitsPerWord / 2)))
+        mu = WordMax / modulus + (WordMax % modulus == modulus - 1 ? 1 : 0); // floor(2 ^ BitsPerWord / modulus)
+}
+
+WordType WordBarrettReducer::reduce(BigUnsigned v) const
+{
+    return reduce(v.data->words, v.data->size);
+}
+
+WordType WordBarrettReducer::reduce(const WordType words[], size_t size) const
+{
+    if(modulus == 1)
+        return 0;
+    WordType remainder = 0;
+    if(mu == 0)
+        return divideWordsByWord(NULL, words, size, modulus);
+    const size_t halfBits = BitsPerWord / 2;
+    const WordType halfMask = ((WordType)1 << halfBits) - 1;
+    for(size_t i = 0, j = size - 1; i < size; i++, j--)
+    {
+        remainder = reduceWord((remainder << halfBits) | (words[j] >> halfBits));
+        remainder = reduceWord((remainder << halfBits) | (words[j] & halfMask));
+    }
+    return remainder;
+}
+
+WordType WordBarrettReducer::reduce(WordType v) const
+{
+    if(modulus == 1)
+        return 0;
+    if(mu == 0)
+        return v % modulus;
+    return reduceWord(v);
+}
+
+inline WordType WordBarrettReducer::reduceWord(WordType v) const
+{
+    WordType quotient, discard;
+    multiplyDoubleWord(v, mu, quotient, discard);
+    v -= quotient * modulus;
+    if(v >= modulus)
+        v -= modulus;
+    return v;
+}
@@ -8,38 +8,338 @@
 #include <cmath>
 #include <climits>
 #include <algorithm> // for swap
+#include <vector>
+#include <new>
 
 using namespace std;
 
+/** the word (limb) size. 32 bits suits the Cortex-M3's 32 x 32 -> 64 bit multiply. Hosts with
+  * unsigned __int128 can define BIGMATH_WORD_BITS=64 for half as many words per number.
+  * Values, byte strings, hex and base64 come out the same for either size.
+  */
+#ifndef BIGMATH_WORD_BITS
+#define BIGMATH_WORD_BITS 32
+#endif
+
+#if BIGMATH_WORD_BITS == 32
 typedef uint32_t WordType;
 typedef uint64_t DoubleWordType;
+#elif BIGMATH_WORD_BITS == 64
+#ifndef __SIZEOF_INT128__
+#error BIGMATH_WORD_BITS=64 needs unsigned __int128
+#endif
+typedef uint64_t WordType;
+typedef unsigned __int128 DoubleWordType;
+#else
+#error BIGMATH_WORD_BITS must be 32 or 64
+#endif
 const WordType WordMax = ~(WordType)0;
 const size_t BytesPerWord = sizeof(WordType) / sizeof(uint8_t);
 const size_t BitsPerWord = BytesPerWord * 8;
 
+void handleError(string msg);
+
+enum BigMathOperation // BigMathProfile counts each once, where the work is done rather than at every overload it passes through
+{
+    BigMathAdd,
+    BigMathSubtract,
+    BigMathMultiply,
+    BigMathSquare,
+    BigMathDivide,
+    BigMathShift,
+    BigMathGcd,
+    BigMathPowMod,
+    BigMathConvert, // parsing and formatting
+    BigMathOperationCount
+};
+
+#ifdef BIGMATH_PROFILE
+/** where the heap goes in BigUnsigned and which operations ran, for watching the device
+  * without a debugger. Only built with BIGMATH_PROFILE, otherwise the hooks are empty.
+  */
+struct BigMathProfile
+{
+    size_t allocationCount, allocatedBytes; // word arrays and Data blocks
+    size_t liveBytes, peakBytes; // peakBytes since the last reset
+    size_t copyOnWriteCount; // shared Data blocks cloned before a write
+    size_t expandCount; // word arrays reallocated to grow
+    size_t operationCounts[BigMathOperationCount];
+};
+extern BigMathProfile bigMathProfile;
+BigMathProfile getBigMathProfile(); // a snapshot
+void resetBigMathProfile(); // zero everything but liveBytes
+const char * getBigMathOperationName(BigMathOperation operation);
+void printBigMathProfile(const BigMathProfile & profile);
+inline void profileBigMathAllocation(size_t bytes)
+{
+    bigMathProfile.allocationCount++;
+    bigMathProfile.allocatedBytes += bytes;
+    bigMathProfile.liveBytes += bytes;
+    if(bigMathProfile.liveBytes > bigMathProfile.peakBytes)
+        bigMathProfile.peakBytes = bigMathProfile.liveBytes;
+}
+inline void profileBigMathFree(size_t bytes)
+{
+    bigMathProfile.liveBytes -= bytes;
+}
+inline void profileBigMathCopyOnWrite()
+{
+    bigMathProfile.copyOnWriteCount++;
+}
+inline void profileBigMathExpand()
+{
+    bigMathProfile.expandCount++;
+}
+inline void profileBigMathOperation(BigMathOperation operation)
+{
+    bigMathProfile.operationCounts[operation]++;
+}
+#else
+inline void profileBigMathAllocation(size_t)
+{
+}
+inline void profileBigMathFree(size_t)
+{
+}
+inline void profileBigMathCopyOnWrite()
+{
+}
+inline void profileBigMathExpand()
+{
+}
+inline void profileBigMathOperation(BigMathOperation)
+{
+}
+#endif
+
+#ifdef BIGMATH_POOL
+/** where BigUnsigned gets its Data blocks and word arrays from. Each Data remembers the allocator
+  * that made it, so values can outlive a change of bigMathAllocator.
+  * Only built with BIGMATH_POOL, for the host benches : the device uses BigUnsigned while loading
+  * the key and hardly after, so it takes everything from the heap and Data doesn't carry the pointer.
+  */
+class BigMathAllocator
+{
+public:
+    virtual ~BigMathAllocator()
+    {
+    }
+    virtual size_t getBlockSize(size_t bytes) const = 0; // what allocate(bytes) really hands out, so callers can use all of it
+    virtual void * allocate(size_t bytes) = 0;
+    virtual void deallocate(void * p, size_t bytes) = 0; // bytes as passed to allocate
+};
+
+extern BigMathAllocator * bigMathAllocator; // for new values, NULL for operator new and delete
+
+inline BigMathAllocator * getBigMathAllocator()
+{
+    return bigMathAllocator;
+}
+
+inline void * allocateBigMath(BigMathAllocator * allocator, size_t bytes)
+{
+    profileBigMathAllocation(bytes);
+    if(!allocator)
+        return ::operator new(bytes);
+    return allocator->allocate(bytes);
+}
+
+inline void deallocateBigMath(BigMathAllocator * allocator, void * p, size_t bytes)
+{
+    profileBigMathFree(bytes);
+    if(!allocator)
+        ::operator delete(p);
+    else
+        allocator->deallocate(p, bytes);
+}
+
+/** installs an allocator until the end of the scope. There is only the one bigMathAllocator
+  * because the device has no threads.
+  */
+class ScopedBigMathAllocator
+{
+    BigMathAllocator * previous;
+    ScopedBigMathAllocator(const ScopedBigMathAllocator &); // not copyable
+    const ScopedBigMathAllocator & operator =(const ScopedBigMathAllocator &);
+public:
+    explicit ScopedBigMathAllocator(BigMathAllocator * allocator)
+        : previous(bigMathAllocator)
+    {
+        bigMathAllocator = allocator;
+    }
+    ~ScopedBigMathAllocator()
+    {
+        bigMathAllocator = previous;
+    }
+};
+
+/** size class allocator : blocks of MinimumBlockSize << n bytes carved from chunks taken from the heap,
+  * with a free list per size class. Numbers grow into the same few block sizes instead of leaving
+  * odd sized holes in the heap. Blocks bigger than the largest class go straight to the heap.
+  * release() frees every block at once and keeps the chunks for reuse, for arenas.
+  */
+class BigMathPool : public BigMathAllocator
+{
+public:
+    enum {MinimumBlockSize = 8, ClassCount = 10}; // 8 to 4096 bytes
+    struct Statistics
+    {
+        size_t liveBlocks[ClassCount + 1]; // by size class, the last for blocks too big for a class
+        size_t highWaterBlocks[ClassCount + 1];
+        size_t liveBytes, highWaterBytes; // in whole blocks
+        size_t chunkBytes; // taken from the heap for chunks
+    };
+private:
+    struct Chunk
+    {
+        Chunk * next;
+        size_t size, used; // bytes after the header
+    };
+    struct FreeBlock
+    {
+        FreeBlock * next;
+    };
+    enum {ChunkHeaderSize = (sizeof(Chunk) + MinimumBlockSize - 1) / MinimumBlockSize * MinimumBlockSize}; // keeps blocks aligned
+    size_t chunkSize;
+    Chunk * firstChunk, * currentChunk;
+    FreeBlock * freeBlocks[ClassCount];
+    Statistics statistics;
+    static size_t getSizeClass(size_t bytes);
+    void * allocateFromChunks(size_t bytes);
+    BigMathPool(const BigMathPool &); // not copyable
+    const BigMathPool & operator =(const BigMathPool &);
+public:
+    explicit BigMathPool(size_t chunkSize = 1024);
+    ~BigMathPool();
+    size_t getBlockSize(size_t bytes) const;
+    void * allocate(size_t bytes);
+    void deallocate(void * p, size_t bytes);
+    void release(); // every block must have been deallocated
+    const Statistics & getStatistics() const
+    {
+        return statistics;
+    }
+    void printStatistics() const;
+};
+
+/** an arena for one scope : new values come from pool, and all of it is released in one go at the end.
+  * Values made in the scope mustn't outlive it.
+  */
+class ScopedBigMathArena
+{
+    BigMathPool & pool;
+    ScopedBigMathAllocator allocator;
+public:
+    explicit ScopedBigMathArena(BigMathPool & pool)
+        : pool(pool), allocator(&pool)
+    {
+    }
+    ~ScopedBigMathArena()
+    {
+        pool.release();
+    }
+};
+#else
+class BigMathAllocator;
+
+inline BigMathAllocator * getBigMathAllocator()
+{
+    return NULL;
+}
+
+inline void * allocateBigMath(BigMathAllocator *, size_t bytes)
+{
+    profileBigMathAllocation(bytes);
+    return ::operator new(bytes);
+}
+
+inline void deallocateBigMath(BigMathAllocator *, void * p, size_t bytes)
+{
+    profileBigMathFree(bytes);
+    ::operator delete(p);
+}
+
+class ScopedBigMathAllocator // nothing to install without BIGMATH_POOL
+{
+public:
+    explicit ScopedBigMathAllocator(BigMathAllocator *)
+    {
+    }
+};
+#endif
+
+/** word array kernels shared by BigUnsigned and FixedBigUnsigned.
+  * Arrays hold the least significant word first and sizes are in words.
+  */
+int compareWords(const WordType a[], const WordType b[], size_t size); // -1, 0 or 1
+bool addWords(WordType a[], size_t aSize, const WordType b[], size_t bSize); // a += b for aSize >= bSize, returns the carry out
+bool subtractWords(WordType a[], size_t aSize, const WordType b[], size_t bSize); // a -= b for aSize >= bSize, returns the borrow out
+void multiplyWords(WordType result[], const WordType a[], size_t aSize, const WordType b[], size_t bSize); // result[0:aSize+bSize-1] = a * b
+void squareWords(WordType result[], const WordType a[], size_t size); // result[0:2*size-1] = a * a
+/** row kernels under the multiply, Montgomery and division loops : one word y times x[0:len-1] for len >= 1,
+  * returning the word carried out of the top. Written with UMULL and UMLAL on ARMv7-M.
+  */
+WordType mul_1(WordType dest[], const WordType x[], size_t len, WordType y, WordType carry = 0); // dest = x * y + carry
+WordType addmul_1(WordType dest[], const WordType x[], size_t len, WordType y); // dest += x * y
+WordType submul_1(WordType dest[], const WordType x[], size_t len, WordType y); // dest -= x * y, returning the borrow
+void lshiftWords(WordType dest[], const WordType src[], size_t size, size_t shiftCount); // shiftCount < BitsPerWord, bits shifted out of the top are lost
+void rshiftWords(WordType dest[], const WordType src[], size_t size, size_t shiftCount); // shiftCount < BitsPerWord
+size_t divideScratchSize(size_t aSize, size_t bSize);
+/** Compute quotient[0:aSize-bSize] = a / b and remainder[0:bSize-1] = a % b for aSize >= bSize
+  * and a nonzero top word in b. Either output may be NULL. scratch has divideScratchSize(aSize, bSize) words.
+  */
+void divideWords(WordType quotient[], WordType remainder[], const WordType a[], size_t aSize, const WordType b[], size_t bSize, WordType scratch[]);
+void appendBase64Words(string & dest, const WordType words[], size_t size); // the digits BigUnsigned::toBase64 gives
+
+class MontgomeryContext;
+class ExponentChain;
+class BarrettReducer;
+class WordBarrettReducer;
+
 class BigUnsigned
 {
+    friend class MontgomeryContext;
+    friend class BarrettReducer;
+    friend class WordBarrettReducer;
     struct Data
     {
         WordType * words;
         WordType word;
         size_t size, allocated;
         size_t refCount;
+#ifdef BIGMATH_POOL
+        BigMathAllocator * allocator; // made this Data and its words
+        BigMathAllocator * getAllocator() const
+        {
+            return allocator;
+        }
+#else
+        BigMathAllocator * getAllocator() const
+        {
+            return NULL;
+        }
+#endif
         Data(WordType v = 0, size_t size = 1)
             : words(&word), word(v), size(size), allocated(size), refCount(1)
+#ifdef BIGMATH_POOL
+            , allocator(bigMathAllocator)
+#endif
         {
             if(size > 1)
             {
-                words = new WordType[allocated];
+                words = allocateWords(allocated);
                 words[0] = v;
                 for(size_t i = 1; i < size; i++)
                     words[i] = 0;
             }
         }
-        Data(Data & rt)
+        Data(Data & rt, size_t minimumAllocated = 0)
             : refCount(1)
+#ifdef BIGMATH_POOL
+            , allocator(bigMathAllocator)
+#endif
         {
-            if(rt.size <= 1)
+            if(rt.size <= 1 && minimumAllocated <= 1)
             {
                 size = 1;
                 words = &word;
@@ -51,8 +351,8 @@ class BigUnsigned
             else
             {
                 size = rt.size;
-                allocated = rt.size;
-                words = new WordType[allocated];
+                allocated = max(rt.size, minimumAllocated);
+                words = allocateWords(allocated);
                 for(size_t i = 0; i < size; i++)
                 {
                     words[i] = rt.words[i];
@@ -60,9 +360,31 @@ class BigUnsigned
             }
         }
         ~Data()
+        {
+            freeWords();
+        }
+        static Data * create(WordType v = 0, size_t size = 1)
+        {
+            return new(allocateBigMath(getBigMathAllocator(), sizeof(Data))) Data(v, size);
+        }
+        static Data * clone(Data & rt, size_t minimumAllocated)
+        {
+            return new(allocateBigMath(getBigMathAllocator(), sizeof(Data))) Data(rt, minimumAllocated);
+        }
+        WordType * allocateWords(size_t & count) // rounds count up to use all of the allocator's block
+        {
+            size_t bytes = count * sizeof(WordType);
+#ifdef BIGMATH_POOL
+            if(allocator)
+                bytes = allocator->getBlockSize(bytes);
+#endif
+            count = bytes / sizeof(WordType);
+            return (WordType *)allocateBigMath(getAllocator(), bytes);
+        }
+        void freeWords()
         {
             if(words != &word)
-                delete []words;
+                deallocateBigMath(getAllocator(), words, allocated * sizeof(WordType));
         }
         void expand(size_t newSize)
         {
@@ -70,15 +392,16 @@ class BigUnsigned
                 return;
             if(newSize > allocated)
             {
-                allocated = newSize + size / 4;
-                WordType * newWords = new WordType[allocated];
+                size_t newAllocated = newSize + size / 4;
+                profileBigMathExpand();
+                WordType * newWords = allocateWords(newAllocated);
                 for(size_t i = 0; i < size; i++)
                 {
                     newWords[i] = words[i];
                 }
-                if(words != &word)
-                    delete []words;
+                freeWords();
                 words = newWords;
+                allocated = newAllocated;
             }
             for(size_t i = size; i < newSize; i++)
             {
@@ -95,21 +418,20 @@ class BigUnsigned
         {
             refCount++;
         }
+        static void destroy(Data * data) __attribute__((noinline)); // kept out of line, so GCC doesn't take a later refCount as a use after free
         void delRef()
         {
-            refCount--;
-            if(refCount == 0)
-            {
-                delete this;
-            }
+            if(--refCount == 0)
+                destroy(this);
         }
     };
     Data * data;
-    void onWrite()
+    void onWrite(size_t minimumAllocated = 0) // minimumAllocated saves a reallocation when the caller is about to expand
     {
         if(data->refCount <= 1)
             return;
-        Data * newData = new Data(*data);
+        profileBigMathCopyOnWrite();
+        Data * newData = Data::clone(*data, minimumAllocated);
         data->delRef();
         data = newData;
     }
@@ -120,7 +442,7 @@ class BigUnsigned
             data->size--;
     }
     BigUnsigned(WordType v, size_t size)
-        : data(new Data(v, size))
+        : data(Data::create(v, size))
     {
     }
     static char getHexDigit(unsigned digit)
@@ -138,6 +460,8 @@ public:
         {
             if(!smallNumbers)
             {
+                ScopedBigMathAllocator heap(NULL); // they live forever, so not in an arena
+                profileBigMathAllocation(SmallNumberCount * sizeof(Data));
                 smallNumbers = new Data[SmallNumberCount];
                 for(WordType i = 0; i < SmallNumberCount; i++)
                 {
@@ -148,7 +472,9 @@ public:
             data->addRef();
         }
         else
-            data = new Data(v);
+        {
+            data = Data::create(v);
+        }
     }
     ~BigUnsigned()
     {
@@ -198,19 +524,35 @@ public:
     string toString(unsigned base = 10) const;
     static BigUnsigned parseBase64(string str);
     string toBase64() const;
-    friend bool operator ==(WordType w, BigUnsigned n)
+    static BigUnsigned fromWords(const WordType words[], size_t size)
+    {
+        BigUnsigned retval(0, max(size, (size_t)1));
+        for(size_t i = 0; i < size; i++)
+            retval.data->words[i] = words[i];
+        retval.normalize();
+        return retval;
+    }
+    size_t getWordCount() const
+    {
+        return data->size;
+    }
+    WordType getWord(size_t index) const
+    {
+        return index < data->size ? data->words[index] : 0;
+    }
+    friend bool operator ==(WordType w, const BigUnsigned & n)
     {
         if(n.data->size > 1)
             return false;
         return n.data->words[0] == w;
     }
-    friend bool operator ==(BigUnsigned n, WordType w)
+    friend bool operator ==(const BigUnsigned & n, WordType w)
     {
         if(n.data->size > 1)
             return false;
         return n.data->words[0] == w;
     }
-    friend bool operator ==(BigUnsigned a, BigUnsigned b)
+    friend bool operator ==(const BigUnsigned & a, const BigUnsigned & b)
     {
         if(a.data == b.data)
             return true;
@@ -223,31 +565,31 @@ public:
         }
         return true;
     }
-    friend bool operator !=(WordType a, BigUnsigned b)
+    friend bool operator !=(WordType a, const BigUnsigned & b)
     {
         return !operator ==(a, b);
     }
-    friend bool operator !=(BigUnsigned a, WordType b)
+    friend bool operator !=(const BigUnsigned & a, WordType b)
     {
         return !operator ==(a, b);
     }
-    friend bool operator !=(BigUnsigned a, BigUnsigned b)
+    friend bool operator !=(const BigUnsigned & a, const BigUnsigned & b)
     {
         return !operator ==(a, b);
     }
-    friend bool operator >(WordType a, BigUnsigned b)
+    friend bool operator >(WordType a, const BigUnsigned & b)
     {
         if(b.data->size > 1)
             return false;
         return a > b.data->words[0];
     }
-    friend bool operator >(BigUnsigned a, WordType b)
+    friend bool operator >(const BigUnsigned & a, WordType b)
     {
         if(a.data->size > 1)
             return true;
         return a.data->words[0] > b;
     }
-    friend bool operator >(BigUnsigned a, BigUnsigned b)
+    friend bool operator >(const BigUnsigned & a, const BigUnsigned & b)
     {
         if(a.data == b.data)
             return false;
@@ -264,7 +606,7 @@ public:
         }
         return false;
     }
-    friend int compare(BigUnsigned a, BigUnsigned b)
+    friend int compare(const BigUnsigned & a, const BigUnsigned & b)
     {
         if(a.data == b.data)
             return 0;
@@ -281,45 +623,45 @@ public:
         }
         return 0;
     }
-    friend bool operator <(WordType a, BigUnsigned b)
+    friend bool operator <(WordType a, const BigUnsigned & b)
     {
         return operator >(b, a);
     }
-    friend bool operator <(BigUnsigned a, WordType b)
+    friend bool operator <(const BigUnsigned & a, WordType b)
     {
         return operator >(b, a);
     }
-    friend bool operator <(BigUnsigned a, BigUnsigned b)
+    friend bool operator <(const BigUnsigned & a, const BigUnsigned & b)
     {
         return operator >(b, a);
     }
-    friend bool operator >=(WordType a, BigUnsigned b)
+    friend bool operator >=(WordType a, const BigUnsigned & b)
     {
         return !operator <(a, b);
     }
-    friend bool operator >=(BigUnsigned a, WordType b)
+    friend bool operator >=(const BigUnsigned & a, WordType b)
     {
         return !operator <(a, b);
     }
-    friend bool operator >=(BigUnsigned a, BigUnsigned b)
+    friend bool operator >=(const BigUnsigned & a, const BigUnsigned & b)
     {
         return !operator <(a, b);
     }
-    friend bool operator <=(WordType a, BigUnsigned b)
+    friend bool operator <=(WordType a, const BigUnsigned & b)
     {
         return !operator >(a, b);
     }
-    friend bool operator <=(BigUnsigned a, WordType b)
+    friend bool operator <=(const BigUnsigned & a, WordType b)
     {
         return !operator >(a, b);
     }
-    friend bool operator <=(BigUnsigned a, BigUnsigned b)
+    friend bool operator <=(const BigUnsigned & a, const BigUnsigned & b)
     {
         return !operator >(a, b);
     }
-    const BigUnsigned & operator +=(BigUnsigned b);
+    const BigUnsigned & operator +=(const BigUnsigned & b);
     const BigUnsigned & operator +=(WordType b);
-    friend BigUnsigned operator +(BigUnsigned a, BigUnsigned b)
+    friend BigUnsigned operator +(BigUnsigned a, const BigUnsigned & b)
     {
         a += b;
         return a;
@@ -334,7 +676,7 @@ public:
         b += a;
         return b;
     }
-    const BigUnsigned & operator -=(BigUnsigned b);
+    const BigUnsigned & operator -=(const BigUnsigned & b);
     const BigUnsigned & operator -=(WordType b);
     friend BigUnsigned operator -(BigUnsigned a, WordType b)
     {
@@ -353,22 +695,24 @@ public:
         b.data->words[0] = a - b.data->words[0];
         return b;
     }
-    friend BigUnsigned operator -(BigUnsigned a, BigUnsigned b)
+    friend BigUnsigned operator -(BigUnsigned a, const BigUnsigned & b)
     {
         a -= b;
         return a;
     }
-    friend BigUnsigned operator *(BigUnsigned a, WordType b);
-    friend BigUnsigned operator *(WordType a, BigUnsigned b)
+    friend BigUnsigned operator *(const BigUnsigned & a, WordType b);
+    friend BigUnsigned operator *(WordType a, const BigUnsigned & b)
     {
         return operator *(b, a);
     }
-    friend BigUnsigned operator *(BigUnsigned a, BigUnsigned b);
+    friend BigUnsigned operator *(const BigUnsigned & a, const BigUnsigned & b);
+    friend BigUnsigned square(const BigUnsigned & a);
+    static size_t karatsubaThreshold; // operands of at least this many words are multiplied with Karatsuba's method
     const BigUnsigned & operator *=(WordType b)
     {
         return operator =(operator *(*this, b));
     }
-    const BigUnsigned & operator *=(BigUnsigned b)
+    const BigUnsigned & operator *=(const BigUnsigned & b)
     {
         return operator =(operator *(*this, b));
     }
@@ -379,59 +723,60 @@ public:
         b.data = temp;
     }
 private:
-    static void divMod(BigUnsigned dividend, BigUnsigned divisor, BigUnsigned * pquotient, BigUnsigned * premainder);
-    static void divMod(WordType dividend, BigUnsigned divisor, BigUnsigned * pquotient, BigUnsigned * premainder);
-    static void divMod(BigUnsigned dividend, WordType divisor, BigUnsigned * pquotient, BigUnsigned * premainder);
+    static void divMod(const BigUnsigned & dividend, const BigUnsigned & divisor, BigUnsigned * pquotient, BigUnsigned * premainder);
+    static void divMod(WordType dividend, const BigUnsigned & divisor, BigUnsigned * pquotient, BigUnsigned * premainder);
+    static void divMod(const BigUnsigned & dividend, WordType divisor, BigUnsigned * pquotient, BigUnsigned * premainder);
+    static BigUnsigned lehmerGcd(const BigUnsigned & a, const BigUnsigned & b, BigUnsigned * pcoefficient);
 public:
-    static void divMod(BigUnsigned dividend, BigUnsigned divisor, BigUnsigned & quotient, BigUnsigned & remainder)
+    static void divMod(const BigUnsigned & dividend, const BigUnsigned & divisor, BigUnsigned & quotient, BigUnsigned & remainder)
     {
         divMod(dividend, divisor, &quotient, &remainder);
     }
-    static void divMod(WordType dividend, BigUnsigned divisor, BigUnsigned & quotient, BigUnsigned & remainder)
+    static void divMod(WordType dividend, const BigUnsigned & divisor, BigUnsigned & quotient, BigUnsigned & remainder)
     {
         divMod(dividend, divisor, &quotient, &remainder);
     }
-    static void divMod(BigUnsigned dividend, WordType divisor, BigUnsigned & quotient, BigUnsigned & remainder)
+    static void divMod(const BigUnsigned & dividend, WordType divisor, BigUnsigned & quotient, BigUnsigned & remainder)
     {
         divMod(dividend, divisor, &quotient, &remainder);
     }
-    friend BigUnsigned operator /(BigUnsigned dividend, BigUnsigned divisor)
+    friend BigUnsigned operator /(const BigUnsigned & dividend, const BigUnsigned & divisor)
     {
         BigUnsigned retval;
         divMod(dividend, divisor, &retval, NULL);
         return retval;
     }
-    friend BigUnsigned operator /(WordType dividend, BigUnsigned divisor)
+    friend BigUnsigned operator /(WordType dividend, const BigUnsigned & divisor)
     {
         BigUnsigned retval;
         divMod(dividend, divisor, &retval, NULL);
         return retval;
     }
-    friend BigUnsigned operator /(BigUnsigned dividend, WordType divisor)
+    friend BigUnsigned operator /(const BigUnsigned & dividend, WordType divisor)
     {
         BigUnsigned retval;
         divMod(dividend, divisor, &retval, NULL);
         return retval;
     }
-    friend BigUnsigned operator %(BigUnsigned dividend, BigUnsigned divisor)
+    friend BigUnsigned operator %(const BigUnsigned & dividend, const BigUnsigned & divisor)
     {
         BigUnsigned retval;
         divMod(dividend, divisor, NULL, &retval);
         return retval;
     }
-    friend BigUnsigned operator %(WordType dividend, BigUnsigned divisor)
+    friend BigUnsigned operator %(WordType dividend, const BigUnsigned & divisor)
     {
         BigUnsigned retval;
         divMod(dividend, divisor, NULL, &retval);
         return retval;
     }
-    friend BigUnsigned operator %(BigUnsigned dividend, WordType divisor)
+    friend BigUnsigned operator %(const BigUnsigned & dividend, WordType divisor)
     {
         BigUnsigned retval;
         divMod(dividend, divisor, NULL, &retval);
         return retval;
     }
-    const BigUnsigned & operator /=(BigUnsigned b)
+    const BigUnsigned & operator /=(const BigUnsigned & b)
     {
         return operator =(operator /(*this, b));
     }
@@ -439,7 +784,7 @@ public:
     {
         return operator =(operator /(*this, b));
     }
-    const BigUnsigned & operator %=(BigUnsigned b)
+    const BigUnsigned & operator %=(const BigUnsigned & b)
     {
         return operator =(operator %(*this, b));
     }
@@ -451,6 +796,25 @@ public:
     {
         return data->words[0];
     }
+    size_t bitLength() const // 0 for 0
+    {
+        size_t retval = BitsPerWord * data->size;
+        WordType topWord = data->words[data->size - 1];
+        if(topWord == 0)
+            return retval - BitsPerWord;
+        while((topWord & ((WordType)1 << (BitsPerWord - 1))) == 0)
+        {
+            topWord <<= 1;
+            retval--;
+        }
+        return retval;
+    }
+    bool getBit(size_t index) const
+    {
+        if(index / BitsPerWord >= data->size)
+            return false;
+        return ((data->words[index / BitsPerWord] >> (index % BitsPerWord)) & 1) != 0;
+    }
     operator bool() const
     {
         return data->size != 1 || data->words[0] != 0;
@@ -459,7 +823,7 @@ public:
     {
         return data->size == 1 && data->words[0] == 0;
     }
-    const BigUnsigned & operator ^=(BigUnsigned b)
+    const BigUnsigned & operator ^=(const BigUnsigned & b)
     {
         onWrite();
         data->expand(b.data->size);
@@ -486,12 +850,12 @@ public:
         a ^= b;
         return a;
     }
-    friend BigUnsigned operator ^(BigUnsigned a, BigUnsigned b)
+    friend BigUnsigned operator ^(BigUnsigned a, const BigUnsigned & b)
     {
         a ^= b;
         return a;
     }
-    const BigUnsigned & operator |=(BigUnsigned b)
+    const BigUnsigned & operator |=(const BigUnsigned & b)
     {
         onWrite();
         data->expand(b.data->size);
@@ -517,7 +881,7 @@ public:
         a |= b;
         return a;
     }
-    friend BigUnsigned operator |(BigUnsigned a, BigUnsigned b)
+    friend BigUnsigned operator |(BigUnsigned a, const BigUnsigned & b)
     {
         a |= b;
         return a;
@@ -529,7 +893,7 @@ public:
         data->words[0] &= b;
         return *this;
     }
-    const BigUnsigned & operator &=(BigUnsigned b)
+    const BigUnsigned & operator &=(const BigUnsigned & b)
     {
         onWrite();
         data->size = min(data->size, b.data->size);
@@ -550,55 +914,37 @@ public:
         a &= b;
         return a;
     }
-    friend BigUnsigned operator &(BigUnsigned a, BigUnsigned b)
+    friend BigUnsigned operator &(BigUnsigned a, const BigUnsigned & b)
     {
         a &= b;
         return a;
     }
     const BigUnsigned & operator <<=(size_t shiftCount);
     const BigUnsigned & operator >>=(size_t shiftCount);
-    friend BigUnsigned operator <<(BigUnsigned v, size_t shiftCount)
+    friend BigUnsigned operator <<(const BigUnsigned & v, size_t shiftCount)
     {
-        v <<= shiftCount;
-        return v;
-    }
-    friend BigUnsigned operator >>(BigUnsigned v, size_t shiftCount)
-    {
-        v >>= shiftCount;
-        return v;
+        BigUnsigned retval;
+        shiftLeftInto(retval, v, shiftCount);
+        return retval;
     }
-    friend BigUnsigned pow(BigUnsigned base, BigUnsigned exponent)
+    friend BigUnsigned operator >>(const BigUnsigned & v, size_t shiftCount)
     {
-        BigUnsigned retval(1);
-        exponent.onWrite();
-        size_t exponentWordIndex = 0, exponentWordBitIndex = 0;
-        if((exponent.data->words[exponentWordIndex] & ((WordType)1 << exponentWordBitIndex)) != 0)
-        {
-            retval = base;
-            exponent.data->words[exponentWordIndex] &= ~((WordType)1 << exponentWordBitIndex);
-        }
-        exponentWordBitIndex++;
-        while(exponentWordIndex < exponent.data->size && exponent.data->words[exponent.data->size - 1] != 0)
-        {
-            base *= base;
-            if((exponent.data->words[exponentWordIndex] & ((WordType)1 << exponentWordBitIndex)) != 0)
-            {
-                exponent.data->words[exponentWordIndex] &= ~((WordType)1 << exponentWordBitIndex);
-                retval *= base;
-            }
-            if(++exponentWordBitIndex >= BitsPerWord)
-            {
-                exponentWordBitIndex = 0;
-                exponentWordIndex++;
-            }
-        }
+        BigUnsigned retval;
+        shiftRightInto(retval, v, shiftCount);
         return retval;
     }
-    friend BigUnsigned powMod(BigUnsigned base, BigUnsigned exponent, BigUnsigned modulus)
+    /** in place forms of the operators above. They write into a caller owned result,
+      * reusing its words when it isn't shared, and the result may be one of the operands.
+      */
+    friend void mulAdd(BigUnsigned & dst, const BigUnsigned & a, WordType b, WordType c); // dst = a * b + c
+    friend void mulAdd(BigUnsigned & dst, const BigUnsigned & a, const BigUnsigned & b, const BigUnsigned & c);
+    friend void addShifted(BigUnsigned & dst, const BigUnsigned & b, size_t shiftCount); // dst += b << shiftCount
+    friend void shiftLeftInto(BigUnsigned & dst, const BigUnsigned & src, size_t shiftCount); // dst = src << shiftCount
+    friend void shiftRightInto(BigUnsigned & dst, const BigUnsigned & src, size_t shiftCount); // dst = src >> shiftCount
+    friend void divModInto(BigUnsigned & quotient, BigUnsigned & remainder, const BigUnsigned & dividend, const BigUnsigned & divisor);
+    friend void divModInto(BigUnsigned & quotient, WordType & remainder, const BigUnsigned & dividend, WordType divisor);
+    friend BigUnsigned pow(BigUnsigned base, BigUnsigned exponent)
     {
-        if(modulus == (WordType)1)
-            return BigUnsigned(0);
-        base %= modulus;
         BigUnsigned retval(1);
         exponent.onWrite();
         size_t exponentWordIndex = 0, exponentWordBitIndex = 0;
@@ -610,13 +956,11 @@ public:
         exponentWordBitIndex++;
         while(exponentWordIndex < exponent.data->size && exponent.data->words[exponent.data->size - 1] != 0)
         {
-            base *= base;
-            base %= modulus;
+            base = square(base);
             if((exponent.data->words[exponentWordIndex] & ((WordType)1 << exponentWordBitIndex)) != 0)
             {
                 exponent.data->words[exponentWordIndex] &= ~((WordType)1 << exponentWordBitIndex);
                 retval *= base;
-                retval %= modulus;
             }
             if(++exponentWordBitIndex >= BitsPerWord)
             {
@@ -626,7 +970,11 @@ public:
         }
         return retval;
     }
-    friend ostream & operator <<(ostream & os, BigUnsigned v)
+    friend BigUnsigned powMod(BigUnsigned base, BigUnsigned exponent, BigUnsigned modulus);
+    friend BigUnsigned powMod(BigUnsigned base, BigUnsigned exponent, const MontgomeryContext & context);
+    friend BigUnsigned powMod(BigUnsigned base, const ExponentChain & exponent, const BarrettReducer & reducer);
+    friend BigUnsigned powMod(BigUnsigned base, const ExponentChain & exponent, const MontgomeryContext & context);
+    friend ostream & operator <<(ostream & os, const BigUnsigned & v)
     {
         unsigned base;
         switch(os.flags() & ios::basefield)
@@ -643,23 +991,18 @@ public:
         }
         return os << v.toString(base);
     }
-    friend BigUnsigned gcd(BigUnsigned a, BigUnsigned b)
+    /** Lehmer's gcd : Euclid's algorithm run on the leading words, with a full precision
+      * step only every word's worth of quotients. 0 if a or b is 0.
+      */
+    friend BigUnsigned gcd(const BigUnsigned & a, const BigUnsigned & b)
     {
-        if(a == (WordType)0 || b == (WordType)0)
-            return 0;
-        if(a == (WordType)1 || b == (WordType)1)
-            return 1;
-        if(a < b)
-            a.swap(b);
-        for(;;)
-        {
-            BigUnsigned c = a % b;
-            if(c == (WordType)0)
-                return b;
-            a = b;
-            b = c;
-        }
+        return lehmerGcd(a, b, NULL);
     }
+    /** g = gcd(a, b) with Bezout coefficients a * x - b * y == g where 1 <= x <= b / g.
+      * Like gcd, g, x and y are 0 if a or b is 0.
+      */
+    friend BigUnsigned extendedGcd(const BigUnsigned & a, const BigUnsigned & b, BigUnsigned & x, BigUnsigned & y);
+    friend BigUnsigned modInverse(const BigUnsigned & a, const BigUnsigned & modulus); // x < modulus with a * x % modulus == 1 % modulus
     const BigUnsigned & operator ++()
     {
         return *this += (WordType)1;
@@ -682,6 +1025,702 @@ public:
     }
 };
 
+/** an exponent recoded into a left-to-right sliding window square and multiply chain.
+  * The chain starts from base ^ (2 * getStep(0).tableIndex + 1). Each later step squares
+  * squareCount times and then multiplies by base ^ (2 * tableIndex + 1), taken from a table
+  * of the odd powers of the base below 2 ^ getWindowSize(). After the last step the result
+  * is squared getTrailingSquareCount() more times.
+  * Short exponents get a window of 1, so 65537 is 16 squarings and 1 multiply.
+  */
+class ExponentChain
+{
+public:
+    struct Step
+    {
+        size_t squareCount;
+        size_t tableIndex;
+    };
+private:
+    vector<Step> steps;
+    size_t windowSize;
+    size_t trailingSquareCount;
+public:
+    explicit ExponentChain(BigUnsigned exponent);
+    size_t getWindowSize() const
+    {
+        return windowSize;
+    }
+    size_t getTableSize() const
+    {
+        return (size_t)1 << (windowSize - 1);
+    }
+    size_t getStepCount() const
+    {
+        return steps.size();
+    }
+    const Step & getStep(size_t index) const
+    {
+        return steps[index];
+    }
+    size_t getTrailingSquareCount() const
+    {
+        return trailingSquareCount;
+    }
+};
+
+/** precomputed values for Montgomery multiplication modulo an odd modulus.
+  * Values in Montgomery form are v * R mod modulus, where R = 2 ^ (BitsPerWord * getSize()).
+  * Build one context per modulus and reuse it for every powMod with that modulus.
+  */
+class MontgomeryContext
+{
+    BigUnsigned modulus;
+    BigUnsigned rSquared; // R * R mod modulus
+    WordType inverse; // -modulus ^ -1 mod 2 ^ BitsPerWord
+    size_t size;
+    void initialize();
+    void load(WordType dest[], BigUnsigned v) const;
+    BigUnsigned store(const WordType src[]) const;
+public:
+    explicit MontgomeryContext(BigUnsigned modulus);
+    MontgomeryContext(BigUnsigned modulus, BigUnsigned rSquared); // rSquared from a previous getRSquared() for the same modulus
+    const BigUnsigned & getModulus() const
+    {
+        return modulus;
+    }
+    const BigUnsigned & getRSquared() const
+    {
+        return rSquared;
+    }
+    size_t getSize() const
+    {
+        return size;
+    }
+    BigUnsigned toMontgomery(BigUnsigned v) const;
+    BigUnsigned fromMontgomery(BigUnsigned v) const;
+    BigUnsigned multiply(BigUnsigned a, BigUnsigned b) const; // a * b / R mod modulus
+    BigUnsigned square(BigUnsigned a) const; // a * a / R mod modulus
+    friend BigUnsigned powMod(BigUnsigned base, const ExponentChain & exponent, const MontgomeryContext & context);
+    size_t getPowModScratchSize(const ExponentChain & exponent) const;
+    /** Compute result[0:getSize()-1] = base[0:baseSize-1] ^ exponent mod modulus for baseSize <= getSize(),
+      * in getPowModScratchSize(exponent) words of scratch and without allocating.
+      */
+    void powModWords(WordType result[], const WordType base[], size_t baseSize, const ExponentChain & exponent, WordType scratch[]) const;
+};
+
+/** reduces by a fixed modulus with Barrett's method : mu = B ^ (2 * size) / modulus is
+  * computed once, then each reduction of a value below B ^ (2 * size) takes two
+  * multiplies and no division. B is 2 ^ BitsPerWord and size is the modulus's word count.
+  * Works for any modulus, so powMod uses it for even moduli where Montgomery can't be used.
+  */
+class BarrettReducer
+{
+    BigUnsigned modulus, mu;
+    size_t size;
+    void divMod(const BigUnsigned & v, BigUnsigned * pquotient, BigUnsigned * premainder) const;
+public:
+    explicit BarrettReducer(BigUnsigned modulus);
+    const BigUnsigned & getModulus() const
+    {
+        return modulus;
+    }
+    BigUnsigned reduce(BigUnsigned v) const; // v % modulus
+    void divMod(const BigUnsigned & v, BigUnsigned & quotient, BigUnsigned & remainder) const
+    {
+        divMod(v, &quotient, &remainder);
+    }
+};
+
+/** BarrettReducer for a single word modulus like the 8191 checksum.
+  * Moduli of up to half a word reduce half a word at a time with one single word
+  * multiply per step instead of a double word division. Larger moduli fall back to division.
+  */
+class WordBarrettReducer
+{
+    WordType modulus, mu; // mu = 2 ^ BitsPerWord / modulus, or 0 if modulus is too large
+    WordType reduceWord(WordType v) const;
+public:
+    explicit WordBarrettReducer(WordType modulus);
+    WordType getModulus() const
+    {
+        return modulus;
+    }
+    WordType reduce(BigUnsigned v) const; // v % modulus
+    WordType reduce(const WordType words[], size_t size) const;
+    WordType reduce(WordType v) const;
+};
+
+/** a BigUnsigned that keeps up to Words words inline instead of on the heap,
+  * so arithmetic on it never allocates. Results that don't fit are an error.
+  * Use it where the largest value is known, like one RSA block, and convert
+  * to and from BigUnsigned where allocating doesn't matter.
+  */
+template <size_t Words>
+class FixedBigUnsigned
+{
+    WordType words[Words];
+    size_t size; // at least 1, and the top word is only 0 for 0
+    void normalize()
+    {
+        while(size > 1 && words[size - 1] == 0)
+            size--;
+    }
+    void expand(size_t newSize) // zero fills words up to newSize
+    {
+        if(newSize > Words)
+            handleError("overflow in FixedBigUnsigned");
+        for(; size < newSize; size++)
+            words[size] = 0;
+    }
+    template <size_t W>
+    friend FixedBigUnsigned<W> powMod(const FixedBigUnsigned<W> & base, const ExponentChain & exponent, const MontgomeryContext & context, WordType scratch[]);
+public:
+    FixedBigUnsigned(WordType v = 0)
+        : size(1)
+    {
+        words[0] = v;
+    }
+    FixedBigUnsigned(const FixedBigUnsigned & rt)
+        : size(rt.size)
+    {
+        for(size_t i = 0; i < size; i++)
+            words[i] = rt.words[i];
+    }
+    const FixedBigUnsigned & operator =(const FixedBigUnsigned & rt)
+    {
+        size = rt.size;
+        for(size_t i = 0; i < size; i++)
+            words[i] = rt.words[i];
+        return *this;
+    }
+    explicit FixedBigUnsigned(const BigUnsigned & v)
+        : size(1)
+    {
+        words[0] = 0;
+        expand(v.getWordCount());
+        for(size_t i = 0; i < size; i++)
+            words[i] = v.getWord(i);
+    }
+    static FixedBigUnsigned fromWords(const WordType src[], size_t srcSize)
+    {
+        FixedBigUnsigned retval;
+        retval.expand(srcSize);
+        for(size_t i = 0; i < srcSize; i++)
+            retval.words[i] = src[i];
+        retval.normalize();
+        return retval;
+    }
+    BigUnsigned toBigUnsigned() const
+    {
+        return BigUnsigned::fromWords(words, size);
+    }
+    const WordType * getWords() const
+    {
+        return words;
+    }
+    size_t getWordCount() const
+    {
+        return size;
+    }
+    static size_t getCapacity()
+    {
+        return Words;
+    }
+    /** same as BigUnsigned::fromByteString(str.substr(offset, count)) */
+    static FixedBigUnsigned fromByteString(const string & str, size_t offset = 0, size_t count = string::npos)
+    {
+        count = min(count, str.size() - offset);
+        size_t byteCount = count + 1;
+        FixedBigUnsigned retval;
+        retval.expand((byteCount + BytesPerWord - 1) / BytesPerWord);
+        for(size_t i = 0; i < byteCount; i++)
+        {
+            WordType currentByte = i == 0 ? 1 : (uint8_t)str[offset + i - 1];
+            size_t bytePos = byteCount - 1 - i;
+            retval.words[bytePos / BytesPerWord] |= currentByte << (8 * (bytePos % BytesPerWord));
+        }
+        retval.normalize();
+        return retval;
+    }
+    string toBase64() const
+    {
+        string retval;
+        appendBase64Words(retval, words, size);
+        return retval;
+    }
+    void appendBase64(string & dest) const
+    {
+        appendBase64Words(dest, words, size);
+    }
+    string toString(unsigned base = 10) const
+    {
+        return toBigUnsigned().toString(base);
+    }
+    friend int compare(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        if(a.size != b.size)
+            return a.size > b.size ? 1 : -1;
+        return compareWords(a.words, b.words, a.size);
+    }
+    friend bool operator ==(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        return compare(a, b) == 0;
+    }
+    friend bool operator ==(const FixedBigUnsigned & a, WordType b)
+    {
+        return a.size == 1 && a.words[0] == b;
+    }
+    friend bool operator ==(WordType a, const FixedBigUnsigned & b)
+    {
+        return b.size == 1 && b.words[0] == a;
+    }
+    friend bool operator !=(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        return compare(a, b) != 0;
+    }
+    friend bool operator !=(const FixedBigUnsigned & a, WordType b)
+    {
+        return !operator ==(a, b);
+    }
+    friend bool operator !=(WordType a, const FixedBigUnsigned & b)
+    {
+        return !operator ==(a, b);
+    }
+    friend bool operator <(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        return compare(a, b) < 0;
+    }
+    friend bool operator <(const FixedBigUnsigned & a, WordType b)
+    {
+        return a.size == 1 && a.words[0] < b;
+    }
+    friend bool operator <(WordType a, const FixedBigUnsigned & b)
+    {
+        return b.size > 1 || a < b.words[0];
+    }
+    friend bool operator >(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        return compare(a, b) > 0;
+    }
+    friend bool operator >(const FixedBigUnsigned & a, WordType b)
+    {
+        return operator <(b, a);
+    }
+    friend bool operator >(WordType a, const FixedBigUnsigned & b)
+    {
+        return operator <(b, a);
+    }
+    friend bool operator <=(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        return compare(a, b) <= 0;
+    }
+    friend bool operator <=(const FixedBigUnsigned & a, WordType b)
+    {
+        return !operator <(b, a);
+    }
+    friend bool operator <=(WordType a, const FixedBigUnsigned & b)
+    {
+        return !operator <(b, a);
+    }
+    friend bool operator >=(const FixedBigUnsigned & a, const FixedBigUnsigned & b)
+    {
+        return compare(a, b) >= 0;
+    }
+    friend bool operator >=(const FixedBigUnsigned & a, WordType b)
+    {
+        return !operator <(a, b);
+    }
+    friend bool operator >=(WordType a, const FixedBigUnsigned & b)
+    {
+        return !operator <(a, b);
+    }
+    const FixedBigUnsigned & operator +=(const FixedBigUnsigned & b)
+    {
+        return addWordArray(b.words, b.size);
+    }
+    const FixedBigUnsigned & operator +=(WordType b)
+    {
+        return addWordArray(&b, 1);
+    }
+    friend FixedBigUnsigned operator +(FixedBigUnsigned a, const FixedBigUnsigned & b)
+    {
+        a += b;
+        return a;
+    }
+    friend FixedBigUnsigned operator +(FixedBigUnsigned a, WordType b)
+    {
+        a += b;
+        return a;
+    }
+    friend FixedBigUnsigned operator +(WordType a, FixedBigUnsigned b)
+    {
+        b += a;
+        return b;
+    }
+    const FixedBigUnsigned & operator -=(const FixedBigUnsigned & b)
+    {
+        if(*this < b)
+            handleError("subtraction has negative result in FixedBigUnsigned::operator -=");
+        subtractWords(words, size, b.words, b.size);
+        normalize();
+        return *this;
+    }
+    const FixedBigUnsigned & operator -=(WordType b)
+    {
+        if(*this < b)
+            handleError("subtraction has negative result in FixedBigUnsigned::operator -=");
+        subtractWords(words, size, &b, 1);
+        normalize();
+        return *this;
+    }
+    friend FixedBigUnsigned operator -(FixedBigUnsigned a, const FixedBigUnsigned & b)
+    {
+        a -= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator -(FixedBigUnsigned a, WordType b)
+    {
+        a -= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator -(WordType a, const FixedBigUnsigned & b)
+    {
+        FixedBigUnsigned retval(a);
+        retval -= b;
+        return retval;
+    }
+    const FixedBigUnsigned & operator *=(const FixedBigUnsigned & b)
+    {
+        WordType product[2 * Words];
+        multiplyWords(product, words, size, b.words, b.size);
+        return assignProduct(product, size + b.size);
+    }
+    const FixedBigUnsigned & operator *=(WordType b)
+    {
+        WordType product[Words + 1];
+        multiplyWords(product, words, size, &b, 1);
+        return assignProduct(product, size + 1);
+    }
+    friend FixedBigUnsigned operator *(FixedBigUnsigned a, const FixedBigUnsigned & b)
+    {
+        a *= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator *(FixedBigUnsigned a, WordType b)
+    {
+        a *= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator *(WordType a, FixedBigUnsigned b)
+    {
+        b *= a;
+        return b;
+    }
+    friend FixedBigUnsigned square(const FixedBigUnsigned & a)
+    {
+        WordType product[2 * Words];
+        squareWords(product, a.words, a.size);
+        FixedBigUnsigned retval;
+        retval.assignProduct(product, 2 * a.size);
+        return retval;
+    }
+    static void divMod(const FixedBigUnsigned & dividend, const FixedBigUnsigned & divisor, FixedBigUnsigned * pquotient, FixedBigUnsigned * premainder)
+    {
+        if(divisor == (WordType)0)
+            handleError("division by 0 in FixedBigUnsigned::divMod");
+        if(dividend < divisor)
+        {
+            if(premainder)
+                *premainder = dividend;
+            if(pquotient)
+                *pquotient = 0;
+            return;
+        }
+        WordType quotient[Words], remainder[Words], scratch[2 * Words + 2];
+        size_t quotientSize = dividend.size - divisor.size + 1, remainderSize = divisor.size;
+        divideWords(quotient, remainder, dividend.words, dividend.size, divisor.words, divisor.size, scratch);
+        if(pquotient)
+            *pquotient = fromWords(quotient, quotientSize);
+        if(premainder)
+            *premainder = fromWords(remainder, remainderSize);
+    }
+    static void divMod(const FixedBigUnsigned & dividend, const FixedBigUnsigned & divisor, FixedBigUnsigned & quotient, FixedBigUnsigned & remainder)
+    {
+        divMod(dividend, divisor, &quotient, &remainder);
+    }
+    friend FixedBigUnsigned operator /(const FixedBigUnsigned & dividend, const FixedBigUnsigned & divisor)
+    {
+        FixedBigUnsigned retval;
+        divMod(dividend, divisor, &retval, NULL);
+        return retval;
+    }
+    friend FixedBigUnsigned operator /(const FixedBigUnsigned & dividend, WordType divisor)
+    {
+        return operator /(dividend, FixedBigUnsigned(divisor));
+    }
+    friend FixedBigUnsigned operator /(WordType dividend, const FixedBigUnsigned & divisor)
+    {
+        return operator /(FixedBigUnsigned(dividend), divisor);
+    }
+    friend FixedBigUnsigned operator %(const FixedBigUnsigned & dividend, const FixedBigUnsigned & divisor)
+    {
+        FixedBigUnsigned retval;
+        divMod(dividend, divisor, NULL, &retval);
+        return retval;
+    }
+    friend FixedBigUnsigned operator %(const FixedBigUnsigned & dividend, WordType divisor)
+    {
+        return operator %(dividend, FixedBigUnsigned(divisor));
+    }
+    friend FixedBigUnsigned operator %(WordType dividend, const FixedBigUnsigned & divisor)
+    {
+        return operator %(FixedBigUnsigned(dividend), divisor);
+    }
+    const FixedBigUnsigned & operator /=(const FixedBigUnsigned & b)
+    {
+        divMod(*this, b, this, NULL);
+        return *this;
+    }
+    const FixedBigUnsigned & operator /=(WordType b)
+    {
+        return operator /=(FixedBigUnsigned(b));
+    }
+    const FixedBigUnsigned & operator %=(const FixedBigUnsigned & b)
+    {
+        divMod(*this, b, NULL, this);
+        return *this;
+    }
+    const FixedBigUnsigned & operator %=(WordType b)
+    {
+        return operator %=(FixedBigUnsigned(b));
+    }
+    const FixedBigUnsigned & operator <<=(size_t shiftCount)
+    {
+        if(size == 1 && words[0] == 0)
+            return *this;
+        size_t wordCount = shiftCount / BitsPerWord;
+        shiftCount %= BitsPerWord;
+        size_t oldSize = size;
+        WordType topWord = shiftCount == 0 ? 0 : words[oldSize - 1] >> (BitsPerWord - shiftCount);
+        expand(oldSize + wordCount + (topWord != 0 ? 1 : 0));
+        if(topWord != 0)
+            words[oldSize + wordCount] = topWord;
+        for(size_t i = oldSize; i > 0; i--)
+        {
+            WordType word = words[i - 1] << shiftCount;
+            if(shiftCount != 0 && i > 1)
+                word |= words[i - 2] >> (BitsPerWord - shiftCount);
+            words[i - 1 + wordCount] = word;
+        }
+        for(size_t i = 0; i < wordCount; i++)
+            words[i] = 0;
+        return *this;
+    }
+    const FixedBigUnsigned & operator >>=(size_t shiftCount)
+    {
+        size_t wordCount = shiftCount / BitsPerWord;
+        shiftCount %= BitsPerWord;
+        if(wordCount >= size)
+            return operator =(0);
+        size -= wordCount;
+        for(size_t i = 0; i < size; i++)
+            words[i] = words[i + wordCount];
+        rshiftWords(words, words, size, shiftCount);
+        normalize();
+        return *this;
+    }
+    friend FixedBigUnsigned operator <<(FixedBigUnsigned v, size_t shiftCount)
+    {
+        v <<= shiftCount;
+        return v;
+    }
+    friend FixedBigUnsigned operator >>(FixedBigUnsigned v, size_t shiftCount)
+    {
+        v >>= shiftCount;
+        return v;
+    }
+    const FixedBigUnsigned & operator &=(const FixedBigUnsigned & b)
+    {
+        size = min(size, b.size);
+        for(size_t i = 0; i < size; i++)
+            words[i] &= b.words[i];
+        normalize();
+        return *this;
+    }
+    const FixedBigUnsigned & operator &=(WordType b)
+    {
+        size = 1;
+        words[0] &= b;
+        return *this;
+    }
+    const FixedBigUnsigned & operator |=(const FixedBigUnsigned & b)
+    {
+        expand(b.size);
+        for(size_t i = 0; i < b.size; i++)
+            words[i] |= b.words[i];
+        return *this;
+    }
+    const FixedBigUnsigned & operator |=(WordType b)
+    {
+        words[0] |= b;
+        return *this;
+    }
+    const FixedBigUnsigned & operator ^=(const FixedBigUnsigned & b)
+    {
+        expand(b.size);
+        for(size_t i = 0; i < b.size; i++)
+            words[i] ^= b.words[i];
+        normalize();
+        return *this;
+    }
+    const FixedBigUnsigned & operator ^=(WordType b)
+    {
+        words[0] ^= b;
+        return *this;
+    }
+    friend FixedBigUnsigned operator &(FixedBigUnsigned a, const FixedBigUnsigned & b)
+    {
+        a &= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator &(FixedBigUnsigned a, WordType b)
+    {
+        a &= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator &(WordType a, FixedBigUnsigned b)
+    {
+        b &= a;
+        return b;
+    }
+    friend FixedBigUnsigned operator |(FixedBigUnsigned a, const FixedBigUnsigned & b)
+    {
+        a |= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator |(FixedBigUnsigned a, WordType b)
+    {
+        a |= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator |(WordType a, FixedBigUnsigned b)
+    {
+        b |= a;
+        return b;
+    }
+    friend FixedBigUnsigned operator ^(FixedBigUnsigned a, const FixedBigUnsigned & b)
+    {
+        a ^= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator ^(FixedBigUnsigned a, WordType b)
+    {
+        a ^= b;
+        return a;
+    }
+    friend FixedBigUnsigned operator ^(WordType a, FixedBigUnsigned b)
+    {
+        b ^= a;
+        return b;
+    }
+    const FixedBigUnsigned & operator ++()
+    {
+        return *this += (WordType)1;
+    }
+    FixedBigUnsigned operator ++(int)
+    {
+        FixedBigUnsigned retval = *this;
+        *this += (WordType)1;
+        return retval;
+    }
+    const FixedBigUnsigned & operator --()
+    {
+        return *this -= (WordType)1;
+    }
+    FixedBigUnsigned operator --(int)
+    {
+        FixedBigUnsigned retval = *this;
+        *this -= (WordType)1;
+        return retval;
+    }
+    operator WordType() const
+    {
+        return words[0];
+    }
+    operator bool() const
+    {
+        return size != 1 || words[0] != 0;
+    }
+    bool operator !() const
+    {
+        return size == 1 && words[0] == 0;
+    }
+    size_t bitLength() const // 0 for 0
+    {
+        size_t retval = BitsPerWord * size;
+        WordType topWord = words[size - 1];
+        if(topWord == 0)
+            return retval - BitsPerWord;
+        while((topWord & ((WordType)1 << (BitsPerWord - 1))) == 0)
+        {
+            topWord <<= 1;
+            retval--;
+        }
+        return retval;
+    }
+    bool getBit(size_t index) const
+    {
+        if(index / BitsPerWord >= size)
+            return false;
+        return ((words[index / BitsPerWord] >> (index % BitsPerWord)) & 1) != 0;
+    }
+    friend ostream & operator <<(ostream & os, const FixedBigUnsigned & v)
+    {
+        return os << v.toBigUnsigned();
+    }
+private:
+    const FixedBigUnsigned & addWordArray(const WordType b[], size_t bSize)
+    {
+        expand(max(size, bSize));
+        if(addWords(words, size, b, bSize)) // only a carry needs the extra word, so a full block can still be added to
+        {
+            expand(size + 1);
+            words[size - 1] = 1;
+        }
+        normalize();
+        return *this;
+    }
+    const FixedBigUnsigned & assignProduct(const WordType product[], size_t productSize)
+    {
+        while(productSize > 1 && product[productSize - 1] == 0)
+            productSize--;
+        size = 1;
+        words[0] = 0;
+        expand(productSize);
+        for(size_t i = 0; i < productSize; i++)
+            words[i] = product[i];
+        return *this;
+    }
+};
+
+/** powMod for FixedBigUnsigned without allocating. scratch has context.getPowModScratchSize(exponent) words. */
+template <size_t Words>
+FixedBigUnsigned<Words> powMod(const FixedBigUnsigned<Words> & base, const ExponentChain & exponent, const MontgomeryContext & context, WordType scratch[])
+{
+    const size_t size = context.getSize();
+    FixedBigUnsigned<Words> retval;
+    retval.expand(size);
+    if(base.size > size)
+    {
+        FixedBigUnsigned<Words> reduced = base % FixedBigUnsigned<Words>(context.getModulus());
+        context.powModWords(retval.words, reduced.words, reduced.size, exponent, scratch);
+    }
+    else
+        context.powModWords(retval.words, base.words, base.size, exponent, scratch);
+    retval.normalize();
+    return retval;
+}
+
 namespace std
 {
 template <>
@@ -691,4 +1730,4 @@ inline void swap<BigUnsigned>(BigUnsigned & a, BigUnsigned & b)
 }
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
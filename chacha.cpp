@@ -0,0 +1,261 @@
+#include "chacha.h"
+#include <cstring>
+
+static inline uint32_t load32(const uint8_t * p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void store32(uint8_t * p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t rotateLeft(uint32_t v, int count)
+{
+    return (v << count) | (v >> (32 - count));
+}
+
+static inline void quarterRound(uint32_t & a, uint32_t & b, uint32_t & c, uint32_t & d)
+{
+    a += b;
+    d = rotateLeft(d ^ a, 16);
+    c += d;
+    b = rotateLeft(b ^ c, 12);
+    a += b;
+    d = rotateLeft(d ^ a, 8);
+    c += d;
+    b = rotateLeft(b ^ c, 7);
+}
+
+void chacha20Block(uint8_t output[64], const uint8_t key[ChaChaKeySize], uint32_t counter, const uint8_t nonce[ChaChaNonceSize])
+{
+    uint32_t state[16], x[16];
+    state[0] = 0x61707865; // "expand 32-byte k"
+    state[1] = 0x3320646E;
+    state[2] = 0x79622D32;
+    state[3] = 0x6B206574;
+    for(size_t i = 0; i < 8; i++)
+        state[4 + i] = load32(key + 4 * i);
+    state[12] = counter;
+    for(size_t i = 0; i < 3; i++)
+        state[13 + i] = load32(nonce + 4 * i);
+    memcpy(x, state, sizeof(x));
+    for(size_t i = 0; i < 10; i++)
+    {
+        quarterRound(x[0], x[4], x[8], x[12]);
+        quarterRound(x[1], x[5], x[9], x[13]);
+        quarterRound(x[2], x[6], x[10], x[14]);
+        quarterRound(x[3], x[7], x[11], x[15]);
+        quarterRound(x[0], x[5], x[10], x[15]);
+        quarterRound(x[1], x[6], x[11], x[12]);
+        quarterRound(x[2], x[7], x[8], x[13]);
+        quarterRound(x[3], x[4], x[9], x[14]);
+    }
+    for(size_t i = 0; i < 16; i++)
+        store32(output + 4 * i, x[i] + state[i]);
+}
+
+void chacha20Xor(uint8_t data[], size_t size, const uint8_t key[ChaChaKeySize], uint32_t counter, const uint8_t nonce[ChaChaNonceSize])
+{
+    uint8_t keyStream[64];
+    for(size_t i = 0; i < size; i += 64, counter++)
+    {
+        chacha20Block(keyStream, key, counter, nonce);
+        size_t blockSize = size - i < 64 ? size - i : 64;
+        for(size_t j = 0; j < blockSize; j++)
+            data[i + j] ^= keyStream[j];
+    }
+}
+
+/** h and r are held in 26 bit limbs, so the products fit 64 bits */
+Poly1305::Poly1305(const uint8_t key[Poly1305KeySize])
+    : bufferSize(0)
+{
+    // clamp r as the RFC says
+    r[0] = load32(key) & 0x3FFFFFF;
+    r[1] = (load32(key + 3) >> 2) & 0x3FFFF03;
+    r[2] = (load32(key + 6) >> 4) & 0x3FFC0FF;
+    r[3] = (load32(key + 9) >> 6) & 0x3F03FFF;
+    r[4] = (load32(key + 12) >> 8) & 0x00FFFFF;
+    for(size_t i = 0; i < 5; i++)
+        h[i] = 0;
+    for(size_t i = 0; i < 4; i++)
+        pad[i] = load32(key + 16 + 4 * i);
+}
+
+void Poly1305::processBlocks(const uint8_t * message, size_t size, uint32_t highBit)
+{
+    const uint32_t mask = 0x3FFFFFF;
+    uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+    for(; size >= 16; message += 16, size -= 16)
+    {
+        h0 += load32(message) & mask;
+        h1 += (load32(message + 3) >> 2) & mask;
+        h2 += (load32(message + 6) >> 4) & mask;
+        h3 += (load32(message + 9) >> 6) & mask;
+        h4 += (load32(message + 12) >> 8) | highBit;
+        uint64_t d0 = (uint64_t)h0 * r[0] + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r[1] + (uint64_t)h1 * r[0] + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r[2] + (uint64_t)h1 * r[1] + (uint64_t)h2 * r[0] + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r[3] + (uint64_t)h1 * r[2] + (uint64_t)h2 * r[1] + (uint64_t)h3 * r[0] + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r[4] + (uint64_t)h1 * r[3] + (uint64_t)h2 * r[2] + (uint64_t)h3 * r[1] + (uint64_t)h4 * r[0];
+        uint32_t carry = (uint32_t)(d0 >> 26);
+        h0 = (uint32_t)d0 & mask;
+        d1 += carry;
+        carry = (uint32_t)(d1 >> 26);
+        h1 = (uint32_t)d1 & mask;
+        d2 += carry;
+        carry = (uint32_t)(d2 >> 26);
+        h2 = (uint32_t)d2 & mask;
+        d3 += carry;
+        carry = (uint32_t)(d3 >> 26);
+        h3 = (uint32_t)d3 & mask;
+        d4 += carry;
+        carry = (uint32_t)(d4 >> 26);
+        h4 = (uint32_t)d4 & mask;
+        h0 += carry * 5; // 2 ^ 130 = 5 mod p
+        carry = h0 >> 26;
+        h0 &= mask;
+        h1 += carry;
+    }
+    h[0] = h0;
+    h[1] = h1;
+    h[2] = h2;
+    h[3] = h3;
+    h[4] = h4;
+}
+
+void Poly1305::update(const uint8_t * message, size_t size)
+{
+    if(bufferSize != 0)
+    {
+        size_t count = 16 - bufferSize < size ? 16 - bufferSize : size;
+        memcpy(buffer + bufferSize, message, count);
+        bufferSize += count;
+        message += count;
+        size -= count;
+        if(bufferSize < 16)
+            return;
+        processBlocks(buffer, 16, 1 << 24);
+        bufferSize = 0;
+    }
+    size_t wholeSize = size & ~(size_t)15;
+    processBlocks(message, wholeSize, 1 << 24);
+    memcpy(buffer, message + wholeSize, size - wholeSize);
+    bufferSize = size - wholeSize;
+}
+
+void Poly1305::padToBlock()
+{
+    if(bufferSize == 0)
+        return;
+    memset(buffer + bufferSize, 0, 16 - bufferSize);
+    processBlocks(buffer, 16, 1 << 24);
+    bufferSize = 0;
+}
+
+void Poly1305::finish(uint8_t tag[Poly1305TagSize])
+{
+    const uint32_t mask = 0x3FFFFFF;
+    if(bufferSize != 0)
+    {
+        // a short last block gets its 1 byte here instead of the high bit
+        buffer[bufferSize] = 1;
+        memset(buffer + bufferSize + 1, 0, 15 - bufferSize);
+        processBlocks(buffer, 16, 0);
+        bufferSize = 0;
+    }
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+    uint32_t carry = h1 >> 26;
+    h1 &= mask;
+    h2 += carry;
+    carry = h2 >> 26;
+    h2 &= mask;
+    h3 += carry;
+    carry = h3 >> 26;
+    h3 &= mask;
+    h4 += carry;
+    carry = h4 >> 26;
+    h4 &= mask;
+    h0 += carry * 5;
+    carry = h0 >> 26;
+    h0 &= mask;
+    h1 += carry;
+    // g = h - p, used if it doesn't go negative, chosen without branching
+    uint32_t g0 = h0 + 5;
+    carry = g0 >> 26;
+    g0 &= mask;
+    uint32_t g1 = h1 + carry;
+    carry = g1 >> 26;
+    g1 &= mask;
+    uint32_t g2 = h2 + carry;
+    carry = g2 >> 26;
+    g2 &= mask;
+    uint32_t g3 = h3 + carry;
+    carry = g3 >> 26;
+    g3 &= mask;
+    uint32_t g4 = h4 + carry - (1 << 26);
+    uint32_t select = (g4 >> 31) - 1; // all ones if h >= p
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+    uint32_t words[4];
+    words[0] = h0 | (h1 << 26);
+    words[1] = (h1 >> 6) | (h2 << 20);
+    words[2] = (h2 >> 12) | (h3 << 14);
+    words[3] = (h3 >> 18) | (h4 << 8);
+    uint64_t sum = 0;
+    for(size_t i = 0; i < 4; i++)
+    {
+        sum += (uint64_t)words[i] + pad[i];
+        store32(tag + 4 * i, (uint32_t)sum);
+        sum >>= 32;
+    }
+}
+
+static void computeTag(uint8_t tag[Poly1305TagSize], const uint8_t data[], size_t size, const uint8_t aad[], size_t aadSize,
+                       const uint8_t key[ChaChaKeySize], const uint8_t nonce[ChaChaNonceSize])
+{
+    uint8_t block[64];
+    chacha20Block(block, key, 0, nonce);
+    Poly1305 mac(block);
+    mac.update(aad, aadSize);
+    mac.padToBlock();
+    mac.update(data, size);
+    mac.padToBlock();
+    uint8_t lengths[16];
+    store32(lengths, (uint32_t)aadSize);
+    store32(lengths + 4, 0);
+    store32(lengths + 8, (uint32_t)size);
+    store32(lengths + 12, 0);
+    mac.update(lengths, sizeof(lengths));
+    mac.finish(tag);
+}
+
+void chacha20Poly1305Seal(uint8_t data[], size_t size, const uint8_t aad[], size_t aadSize,
+                          const uint8_t key[ChaChaKeySize], const uint8_t nonce[ChaChaNonceSize], uint8_t tag[Poly1305TagSize])
+{
+    chacha20Xor(data, size, key, 1, nonce);
+    computeTag(tag, data, size, aad, aadSize, key, nonce);
+}
+
+bool chacha20Poly1305Open(uint8_t data[], size_t size, const uint8_t aad[], size_t aadSize,
+                          const uint8_t key[ChaChaKeySize], const uint8_t nonce[ChaChaNonceSize], const uint8_t tag[Poly1305TagSize])
+{
+    uint8_t expected[Poly1305TagSize];
+    computeTag(expected, data, size, aad, aadSize, key, nonce);
+    uint8_t difference = 0;
+    for(size_t i = 0; i < Poly1305TagSize; i++)
+        difference |= expected[i] ^ tag[i];
+    if(difference != 0)
+        return false;
+    chacha20Xor(data, size, key, 1, nonce);
+    return true;
+}
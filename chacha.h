@@ -0,0 +1,39 @@
+#ifndef CHACHA_H
+#define CHACHA_H
+
+#include <stdint.h>
+#include <cstddef>
+
+/** ChaCha20 and Poly1305 as in RFC 8439, for the hybrid payload. Plain C++ on 32 bit words,
+  * so it's fast on the Cortex-M3 without any help from bigmath.
+  */
+const size_t ChaChaKeySize = 32;
+const size_t ChaChaNonceSize = 12;
+const size_t Poly1305KeySize = 32;
+const size_t Poly1305TagSize = 16;
+
+void chacha20Block(uint8_t output[64], const uint8_t key[ChaChaKeySize], uint32_t counter, const uint8_t nonce[ChaChaNonceSize]);
+void chacha20Xor(uint8_t data[], size_t size, const uint8_t key[ChaChaKeySize], uint32_t counter, const uint8_t nonce[ChaChaNonceSize]); // encrypts or decrypts in place
+
+/** the one time authenticator. A key must never be used for two messages. */
+class Poly1305
+{
+    uint32_t r[5], h[5], pad[4];
+    uint8_t buffer[16];
+    size_t bufferSize;
+    void processBlocks(const uint8_t * message, size_t size, uint32_t highBit);
+public:
+    explicit Poly1305(const uint8_t key[Poly1305KeySize]);
+    void update(const uint8_t * message, size_t size);
+    void padToBlock(); // zero pad to a multiple of 16 bytes, as the AEAD construction does
+    void finish(uint8_t tag[Poly1305TagSize]);
+};
+
+/** the ChaCha20-Poly1305 AEAD : data is encrypted in place and tag covers it and aad */
+void chacha20Poly1305Seal(uint8_t data[], size_t size, const uint8_t aad[], size_t aadSize,
+                          const uint8_t key[ChaChaKeySize], const uint8_t nonce[ChaChaNonceSize], uint8_t tag[Poly1305TagSize]);
+/** returns false, leaving data alone, if tag doesn't match. Otherwise decrypts data in place. */
+bool chacha20Poly1305Open(uint8_t data[], size_t size, const uint8_t aad[], size_t aadSize,
+                          const uint8_t key[ChaChaKeySize], const uint8_t nonce[ChaChaNonceSize], const uint8_t tag[Poly1305TagSize]);
+
+#endif
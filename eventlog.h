@@ -0,0 +1,115 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+#include <cstddef>
+
+enum EventDirection
+{
+    EventIn,
+    EventOut
+};
+
+enum EventFlag
+{
+    EventAfterGap = 1 // records before this one were dropped because the log was full
+};
+
+/** one person going through the door. 8 bytes, where the string it replaces took
+  * a heap block for the text plus the deque's bookkeeping.
+  */
+struct EventRecord
+{
+    uint32_t time; // time(NULL) when it happened
+    uint8_t direction; // an EventDirection
+    uint8_t sensorPair; // which pair of sensors saw it, 0 while there's only one
+    uint16_t flags; // EventFlag bits
+};
+
+inline bool sequenceBefore(uint32_t a, uint32_t b) // a comes before b, allowing for wrap around
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/** a fixed size ring of events, oldest first. Nothing is allocated, so push is O(1) and
+  * consuming a sent batch is O(1) however big it is. Every record gets a sequence number;
+  * a batch is remembered by getEndSequence() when it's sent and released with consumeUntil()
+  * when it's acknowledged, which stays right even if records were dropped in between.
+  * Capacity must be a power of two so the sequence numbers can wrap. Record can be any
+  * struct with a flags member for EventAfterGap.
+  */
+template <size_t Capacity, typename Record = EventRecord>
+class EventRing
+{
+    Record records[Capacity];
+    uint32_t startSequence, endSequence; // of the oldest record and the one after the newest
+    uint32_t droppedCount;
+    EventRing(const EventRing &);
+    const EventRing & operator =(const EventRing &);
+public:
+    EventRing()
+        : startSequence(0), endSequence(0), droppedCount(0)
+    {
+    }
+    static size_t capacity()
+    {
+        return Capacity;
+    }
+    size_t size() const
+    {
+        return (size_t)(endSequence - startSequence);
+    }
+    bool empty() const
+    {
+        return endSequence == startSequence;
+    }
+    bool full() const
+    {
+        return size() == Capacity;
+    }
+    uint32_t getDroppedCount() const // since boot
+    {
+        return droppedCount;
+    }
+    uint32_t getStartSequence() const
+    {
+        return startSequence;
+    }
+    uint32_t getEndSequence() const
+    {
+        return endSequence;
+    }
+    const Record & operator [](size_t index) const // 0 is the oldest
+    {
+        return records[(startSequence + index) % Capacity];
+    }
+    void push(const Record & record) // drops the oldest record when full
+    {
+        if(full())
+        {
+            startSequence++;
+            droppedCount++;
+            records[startSequence % Capacity].flags |= EventAfterGap;
+        }
+        records[endSequence++ % Capacity] = record;
+    }
+    void consumeUntil(uint32_t sequence) // drops records before sequence, if they're still here
+    {
+        if(!sequenceBefore(startSequence, sequence))
+            return;
+        if(sequenceBefore(endSequence, sequence))
+            sequence = endSequence;
+        startSequence = sequence;
+    }
+    void addDropped(uint32_t count) // records lost before they got here, eg by a journal that couldn't save them
+    {
+        droppedCount += count;
+    }
+    void restart(uint32_t sequence) // empties the ring; the next record pushed gets this sequence number
+    {
+        droppedCount += size();
+        startSequence = endSequence = sequence;
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "journal.h"
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+
+const uint16_t BatchMagic = 0x4A45; // "EJ"
+const uint32_t CommitMagic = 0x314A4345; // "ECJ1"
+const uint32_t MaxOrphanCount = 16;
+
+/** a batch in a segment file : this header, then count records as they are in memory.
+  * checkSum is the CRC-32 of the other header fields and the records.
+  */
+struct BatchHeader
+{
+    uint16_t magic;
+    uint16_t count;
+    uint32_t firstSequence;
+    uint32_t checkSum;
+};
+
+struct CommitRecord
+{
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t sequence;
+    uint32_t firstSegment;
+    uint32_t checkSum;
+};
+
+static uint32_t crc32(uint32_t crc, const void * data, size_t size)
+{
+    const uint8_t * bytes = (const uint8_t *)data;
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++)
+    {
+        crc ^= bytes[i];
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static uint32_t getBatchCheckSum(const BatchHeader & header, const void * records, size_t recordSize)
+{
+    uint32_t crc = crc32(0, &header, offsetof(BatchHeader, checkSum));
+    return crc32(crc, records, header.count * recordSize);
+}
+
+EventJournal::EventJournal(const string & directory, const string & prefix)
+    : directory(directory), prefix(prefix), generation(0), committedSequence(0), firstSegment(0), acknowledgedEnd(0), journaledEnd(0), endSequence(0), currentSegmentRecordCount(0), startNewSegment(true), afterGap(false), pendingCount(0)
+{
+}
+
+string EventJournal::getSegmentName(uint32_t number) const
+{
+    char name[20];
+    sprintf(name, "%06lu.jnl", (unsigned long)(number % 1000000)); // 8.3 names for the LocalFileSystem
+    return directory + "/" + prefix + name;
+}
+
+string EventJournal::getCommitName(uint32_t slot) const
+{
+    return directory + "/" + prefix + (slot ? "commt1.jnl" : "commt0.jnl");
+}
+
+void EventJournal::readCommit()
+{
+    bool found = false;
+    generation = 0;
+    committedSequence = 0;
+    firstSegment = 0;
+    for(uint32_t slot = 0; slot < 2; slot++)
+    {
+        ifstream is(getCommitName(slot).c_str(), ios::in | ios::binary);
+        CommitRecord record;
+        if(!is.read((char *)&record, sizeof(record)))
+            continue;
+        if(record.magic != CommitMagic || record.checkSum != crc32(0, &record, offsetof(CommitRecord, checkSum)))
+            continue;
+        if(found && !sequenceBefore(generation, record.generation))
+            continue;
+        found = true;
+        generation = record.generation;
+        committedSequence = record.sequence;
+        firstSegment = record.firstSegment;
+    }
+}
+
+bool EventJournal::writeCommit(uint32_t sequence, uint32_t oldestSegment)
+{
+    CommitRecord record;
+    record.magic = CommitMagic;
+    record.generation = generation + 1;
+    record.sequence = sequence;
+    record.firstSegment = oldestSegment;
+    record.checkSum = crc32(0, &record, offsetof(CommitRecord, checkSum));
+    // the other slot from the last good record, so a reset while writing leaves that one
+    ofstream os(getCommitName(record.generation % 2).c_str(), ios::out | ios::binary | ios::trunc);
+    if(!os.write((const char *)&record, sizeof(record)))
+        return false;
+    os.close();
+    if(!os)
+        return false;
+    generation = record.generation;
+    committedSequence = sequence;
+    firstSegment = oldestSegment;
+    return true;
+}
+
+void EventJournal::removeOrphans()
+{
+    // segments left behind by a reset between writing a commit record and deleting them
+    for(uint32_t i = 1; i <= MaxOrphanCount && i <= firstSegment; i++)
+    {
+        if(remove(getSegmentName(firstSegment - i).c_str()) != 0)
+            break;
+    }
+}
+
+bool EventJournal::readBatch(istream & is, uint32_t & firstSequence, void * records, size_t recordSize, size_t & count)
+{
+    BatchHeader header;
+    if(!is.read((char *)&header, sizeof(header)))
+        return false;
+    if(header.magic != BatchMagic || header.count == 0 || header.count > BatchRecordCount)
+        return false;
+    if(!is.read((char *)records, header.count * recordSize))
+        return false;
+    if(header.checkSum != getBatchCheckSum(header, records, recordSize))
+        return false;
+    firstSequence = header.firstSequence;
+    count = header.count;
+    return true;
+}
+
+bool EventJournal::appendBatch(uint32_t firstSequence, const void * records, size_t recordSize, size_t count)
+{
+    if(startNewSegment || segments.empty() || currentSegmentRecordCount + count > SegmentRecordCount)
+    {
+        Segment segment = {segments.empty() ? firstSegment : segments.back().number + 1, firstSequence};
+        ofstream os(getSegmentName(segment.number).c_str(), ios::out | ios::binary | ios::trunc);
+        if(!os)
+            return false;
+        segments.push_back(segment);
+        currentSegmentRecordCount = 0;
+        startNewSegment = false;
+    }
+    BatchHeader header;
+    header.magic = BatchMagic;
+    header.count = (uint16_t)count;
+    header.firstSequence = firstSequence;
+    header.checkSum = getBatchCheckSum(header, records, recordSize);
+    ofstream os(getSegmentName(segments.back().number).c_str(), ios::out | ios::binary | ios::app);
+    os.write((const char *)&header, sizeof(header));
+    os.write((const char *)records, count * recordSize);
+    os.close();
+    if(!os)
+    {
+        startNewSegment = true; // don't add to a segment that may end in half a batch
+        return false;
+    }
+    segments.back().endSequence = firstSequence + (uint32_t)count;
+    currentSegmentRecordCount += count;
+    return true;
+}
+
+bool EventJournal::compact(uint32_t startSequence)
+{
+    // the collector has everything before startSequence, so segments that end by then
+    // aren't needed. The one being added to stays.
+    size_t removeCount = 0;
+    while(removeCount + 1 < segments.size() && !sequenceBefore(startSequence, segments[removeCount].endSequence))
+        removeCount++;
+    if(startSequence == committedSequence && removeCount == 0)
+        return true;
+    if(!writeCommit(startSequence, segments.empty() ? firstSegment : segments[removeCount].number))
+        return false; // the old segments are still needed
+    for(size_t i = 0; i < removeCount; i++)
+        remove(getSegmentName(segments[i].number).c_str());
+    segments.erase(segments.begin(), segments.begin() + removeCount);
+    return true;
+}
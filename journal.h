@@ -0,0 +1,254 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "eventlog.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+
+using namespace std;
+
+/** keeps the records of an EventRing on the LocalFileSystem, so a reset doesn't lose them and
+  * the ring filling up doesn't either. Works for any record type the ring takes; each ring needs
+  * its own journal with its own file name prefix.
+  *
+  * Records go into segment files of up to SegmentRecordCount records, in batches that each
+  * carry their first sequence number and a CRC, so a batch cut off by a reset is spotted and
+  * ignored. The commit record says which sequence the collector has acknowledged up to and
+  * which segment is the first one still needed. It's written to two files in turn, so one of
+  * them is always whole.
+  *
+  * New records go in with add(). While the ring has room they go straight into it; once it's
+  * full they wait in a small buffer here and then in the segments, and the ring is refilled from
+  * them, oldest first, as acknowledge() releases the batches that were sent. A record is only
+  * dropped when the ring is full and /local can't be written.
+  *
+  * Nothing is written per record. flush() writes whatever came in since the last flush, moves
+  * the commit record up to the last acknowledge() and deletes segments that are all before it;
+  * call it every few seconds. It returns false if /local couldn't be written, and the rest is
+  * written by the next call. replay() puts the records that weren't committed back into the
+  * ring at boot, as many as fit. A record acknowledged after the last flush is sent again after
+  * a reset.
+  */
+class EventJournal
+{
+public:
+    enum
+    {
+        BatchRecordCount = 64,
+        SegmentRecordCount = 256,
+        PendingBytes = 256 // records that didn't fit in the ring and aren't written yet
+    };
+private:
+    struct Segment
+    {
+        uint32_t number;
+        uint32_t endSequence; // just after its last record
+    };
+    string directory, prefix;
+    vector<Segment> segments; // oldest first, new records go in back()
+    uint32_t generation; // of the last commit record written
+    uint32_t committedSequence;
+    uint32_t firstSegment; // the number of the oldest segment still needed
+    uint32_t acknowledgedEnd; // sequence the collector has everything before
+    uint32_t journaledEnd; // sequence just after the last record written
+    uint32_t endSequence; // just after the newest record added, in the ring or not
+    size_t currentSegmentRecordCount;
+    bool startNewSegment;
+    bool afterGap; // records were dropped, so the next one added gets EventAfterGap
+    size_t pendingCount;
+    char pending[PendingBytes]; // the records just before endSequence, when they aren't in the ring
+    void readCommit();
+    bool writeCommit(uint32_t sequence, uint32_t oldestSegment);
+    string getSegmentName(uint32_t number) const;
+    string getCommitName(uint32_t slot) const;
+    void removeOrphans();
+    bool readBatch(istream & is, uint32_t & firstSequence, void * records, size_t recordSize, size_t & count);
+    bool appendBatch(uint32_t firstSequence, const void * records, size_t recordSize, size_t count);
+    bool compact(uint32_t startSequence);
+    template <size_t Capacity, typename Record>
+    bool write(const EventRing<Capacity, Record> & ring);
+    template <size_t Capacity, typename Record>
+    void refill(EventRing<Capacity, Record> & ring);
+    EventJournal(const EventJournal &);
+    const EventJournal & operator =(const EventJournal &);
+public:
+    EventJournal(const string & directory, const string & prefix); // prefix is 2 characters, for 8.3 names
+    template <size_t Capacity, typename Record>
+    void replay(EventRing<Capacity, Record> & ring, Record * lastRecord = NULL); // lastRecord gets the newest record in the journal, if there is one
+    template <size_t Capacity, typename Record>
+    void add(EventRing<Capacity, Record> & ring, const Record & record);
+    template <size_t Capacity, typename Record>
+    void acknowledge(EventRing<Capacity, Record> & ring, uint32_t sequence); // the collector has everything before sequence
+    template <size_t Capacity, typename Record>
+    size_t getUnwrittenCount(const EventRing<Capacity, Record> & ring) const
+    {
+        if(sequenceBefore(journaledEnd, ring.getStartSequence()))
+            return (size_t)(endSequence - ring.getStartSequence());
+        return (size_t)(endSequence - journaledEnd);
+    }
+    template <size_t Capacity, typename Record>
+    bool flush(const EventRing<Capacity, Record> & ring)
+    {
+        return write(ring) && compact(acknowledgedEnd);
+    }
+};
+
+template <size_t Capacity, typename Record>
+void EventJournal::replay(EventRing<Capacity, Record> & ring, Record * lastRecord)
+{
+    readCommit();
+    removeOrphans();
+    segments.clear();
+    acknowledgedEnd = journaledEnd = committedSequence;
+    Record records[BatchRecordCount];
+    for(uint32_t number = firstSegment; ; number++)
+    {
+        ifstream is(getSegmentName(number).c_str(), ios::in | ios::binary);
+        if(!is)
+            break;
+        Segment segment = {number, journaledEnd};
+        uint32_t firstSequence;
+        size_t count;
+        while(readBatch(is, firstSequence, records, sizeof(Record), count))
+        {
+            segment.endSequence = firstSequence + (uint32_t)count;
+            if(sequenceBefore(journaledEnd, segment.endSequence))
+                journaledEnd = segment.endSequence;
+            if(lastRecord)
+                *lastRecord = records[count - 1];
+        }
+        segments.push_back(segment);
+    }
+    endSequence = journaledEnd;
+    pendingCount = 0;
+    afterGap = false;
+    startNewSegment = true; // the last segment may end in a torn batch
+    ring.restart(committedSequence);
+    refill(ring);
+}
+
+template <size_t Capacity, typename Record>
+void EventJournal::add(EventRing<Capacity, Record> & ring, const Record & record)
+{
+    Record copy = record;
+    if(afterGap)
+        copy.flags |= EventAfterGap;
+    if(ring.getEndSequence() == endSequence && !ring.full())
+        ring.push(copy);
+    else
+    {
+        // behind the records waiting for room in the ring, so it stays in order
+        if(pendingCount == PendingBytes / sizeof(Record) && !write(ring))
+        {
+            ring.addDropped(1);
+            afterGap = true;
+            return;
+        }
+        memcpy(pending + pendingCount * sizeof(Record), &copy, sizeof(Record));
+        pendingCount++;
+    }
+    endSequence++;
+    afterGap = false;
+}
+
+template <size_t Capacity, typename Record>
+void EventJournal::acknowledge(EventRing<Capacity, Record> & ring, uint32_t sequence)
+{
+    ring.consumeUntil(sequence);
+    acknowledgedEnd = ring.getStartSequence();
+    refill(ring);
+}
+
+template <size_t Capacity, typename Record>
+bool EventJournal::write(const EventRing<Capacity, Record> & ring)
+{
+    if(sequenceBefore(journaledEnd, ring.getStartSequence()))
+        journaledEnd = ring.getStartSequence(); // acknowledged before they were written
+    Record records[BatchRecordCount];
+    while(sequenceBefore(journaledEnd, ring.getEndSequence()))
+    {
+        size_t count = ring.getEndSequence() - journaledEnd;
+        if(count > BatchRecordCount)
+            count = BatchRecordCount;
+        size_t offset = journaledEnd - ring.getStartSequence();
+        for(size_t i = 0; i < count; i++)
+            records[i] = ring[offset + i];
+        if(!appendBatch(journaledEnd, records, sizeof(Record), count))
+            return false;
+        journaledEnd += (uint32_t)count;
+    }
+    // then the ones waiting for room in the ring, which come straight after
+    size_t written = 0;
+    while(written < pendingCount)
+    {
+        size_t count = pendingCount - written;
+        if(count > BatchRecordCount)
+            count = BatchRecordCount;
+        if(!appendBatch(journaledEnd, pending + written * sizeof(Record), sizeof(Record), count))
+            break;
+        journaledEnd += (uint32_t)count;
+        written += count;
+    }
+    pendingCount -= written;
+    memmove(pending, pending + written * sizeof(Record), pendingCount * sizeof(Record));
+    return pendingCount == 0;
+}
+
+template <size_t Capacity, typename Record>
+void EventJournal::refill(EventRing<Capacity, Record> & ring)
+{
+    Record records[BatchRecordCount];
+    for(size_t s = 0; s < segments.size() && !ring.full() && sequenceBefore(ring.getEndSequence(), journaledEnd); s++)
+    {
+        if(!sequenceBefore(ring.getEndSequence(), segments[s].endSequence))
+            continue;
+        ifstream is(getSegmentName(segments[s].number).c_str(), ios::in | ios::binary);
+        uint32_t firstSequence;
+        size_t count;
+        while(!ring.full() && readBatch(is, firstSequence, records, sizeof(Record), count))
+        {
+            for(size_t i = 0; i < count && !ring.full(); i++)
+            {
+                uint32_t sequence = firstSequence + (uint32_t)i;
+                if(sequenceBefore(sequence, ring.getEndSequence()))
+                    continue; // in the ring or acknowledged already
+                if(sequence != ring.getEndSequence())
+                {
+                    // records lost before they were written. The ones in the ring can't keep
+                    // their numbers across the gap, so the rest waits until they're sent
+                    if(!ring.empty())
+                        return;
+                    ring.restart(sequence);
+                    records[i].flags |= EventAfterGap;
+                }
+                ring.push(records[i]);
+            }
+        }
+    }
+    bool lost = false;
+    if(ring.empty() && sequenceBefore(ring.getEndSequence(), journaledEnd))
+    {
+        // the end of the journal couldn't be read back
+        ring.restart(journaledEnd);
+        lost = true;
+    }
+    size_t moved = 0;
+    while(moved < pendingCount && !ring.full() && ring.getEndSequence() == endSequence - (uint32_t)(pendingCount - moved))
+    {
+        Record record;
+        memcpy(&record, pending + moved * sizeof(Record), sizeof(Record));
+        if(lost)
+            record.flags |= EventAfterGap;
+        lost = false;
+        ring.push(record);
+        moved++;
+    }
+    if(lost)
+        afterGap = true;
+    pendingCount -= moved;
+    memmove(pending, pending + moved * sizeof(Record), pendingCount * sizeof(Record));
+}
+
+#endif
@@ -14,7 +14,6 @@
 #include "netif/loopif.h"
 #include "device.h"
 #include <string>
-#include <deque>
 #include <ctime>
 #include <sstream>
 #include <cassert>
@@ -24,6 +23,13 @@
 #include <iostream>
 #include "TextLCD.h"
 #include "bigmath.h"
+#include "rsa.h"
+#include "payload.h"
+#include "prng.h"
+#include "eventlog.h"
+#include "journal.h"
+#include "aggregate.h"
+#include "batch.h"
 
 using namespace std;
 
@@ -60,6 +66,14 @@ struct netif netif_data;
 struct netif *netif = &netif_data;
 bool linkLED = false;
 Timeout ledTimeout;
+RandomGenerator randomGenerator;
+Timer entropyTimer; // free running from the start of main, for the jitter in when things happen
+
+void addTimerEntropy()
+{
+    int now = entropyTimer.read_us();
+    randomGenerator.addEntropy(&now, sizeof(now));
+}
 
 class Watchdog 
 {
@@ -134,7 +148,8 @@ static err_t timeReceiveCallback(void *, tcp_pcb *tcp, pbuf *p, err_t err)
         {
             u32_t v = *(u32_t *)p->payload;
             gotTime = true;
-            srand(v);
+            randomGenerator.addEntropy(&v, sizeof(v));
+            addTimerEntropy();
             time_t tv = ntohl(v) - 2208988800U;
             set_time(tv);
             tv = getLocalTime(tv);
@@ -455,6 +470,348 @@ void sendStringToHost(string data, string host, int port, void (*callback)(bool
     (new SendStringToHostHelper(data, host, port, callback, callbackArg))->start();
 }
 
+const char SessionHello[] = "PCS1\n";
+const char SessionAck = 0x06;
+const char SessionNak = 0x15;
+
+/** one connection to the collector kept open between batches, turned on by "session" in /local/host.txt.
+  * The collector echoes SessionHello, then each batch goes as its length (4 bytes, big endian) and
+  * the data, answered by SessionAck or SessionNak. Errors back off up to MaxBackoff seconds; without
+  * the echo, batches use sendStringToHost and the session is tried again after UnsupportedRetry.
+  */
+class CollectorSession
+{
+    enum State
+    {
+        Closed,
+        Resolving,
+        Connecting,
+        Greeting,
+        Ready,
+        AwaitingAck,
+        Unsupported
+    };
+    enum // seconds, ie calls to poll()
+    {
+        ConnectTimeout = 10,
+        AckTimeout = 10,
+        InitialBackoff = 2,
+        MaxBackoff = 128,
+        UnsupportedRetry = 600
+    };
+    string host;
+    int port;
+    ip_addr ip;
+    tcp_pcb * tcp;
+    volatile State state;
+    string frame, received;
+    size_t amountSentAlready;
+    bool hasPending;
+    string pendingData;
+    void (*pendingCallback)(bool successful, void *);
+    void * pendingCallbackArg;
+    int timer; // seconds in this state
+    int retryDelay; // seconds before connecting again
+    int backoff;
+    bool aborted; // the PCB was aborted, so the lwIP callback has to return ERR_ABRT
+    void finishPending(bool successful)
+    {
+        if(!hasPending)
+            return;
+        hasPending = false;
+        pendingData.clear();
+        frame.clear();
+        if(pendingCallback)
+            pendingCallback(successful, pendingCallbackArg);
+    }
+    void closeConnection(bool abort)
+    {
+        if(tcp)
+        {
+            tcp_arg(tcp, NULL);
+            tcp_sent(tcp, NULL);
+            tcp_recv(tcp, NULL);
+            tcp_err(tcp, NULL);
+            if(abort || tcp_close(tcp) != ERR_OK)
+            {
+                tcp_abort(tcp);
+                aborted = true;
+            }
+        }
+        tcp = NULL;
+        received.clear();
+    }
+    void fail()
+    {
+        closeConnection(true);
+        state = Closed;
+        retryDelay = backoff;
+        backoff = backoff * 2 > MaxBackoff ? MaxBackoff : backoff * 2;
+        finishPending(false);
+    }
+    void unsupported()
+    {
+        printf("collector doesn't support sessions\r\n");
+        closeConnection(true);
+        state = Unsupported;
+        retryDelay = UnsupportedRetry;
+        if(hasPending)
+        {
+            hasPending = false;
+            sendStringToHost(pendingData, host, port, pendingCallback, pendingCallbackArg);
+            pendingData.clear();
+        }
+    }
+    void queueChunk()
+    {
+        size_t sendAmount = frame.size() - amountSentAlready;
+        size_t maxSendAmount = tcp_sndbuf(tcp);
+        u8_t flags = TCP_WRITE_FLAG_COPY;
+        if(maxSendAmount < sendAmount)
+        {
+            sendAmount = maxSendAmount;
+            flags |= TCP_WRITE_FLAG_MORE;
+        }
+        if(sendAmount == 0)
+            return;
+        if(tcp_write(tcp, (void *)(frame.data() + amountSentAlready), sendAmount, flags) == ERR_OK)
+            amountSentAlready += sendAmount;
+    }
+    void sendPending()
+    {
+        uint32_t size = pendingData.size();
+        frame.resize(4);
+        for(size_t i = 0; i < 4; i++)
+            frame[i] = (char)(size >> (8 * (3 - i)));
+        frame += pendingData;
+        amountSentAlready = 0;
+        state = AwaitingAck;
+        timer = 0;
+        queueChunk();
+        tcp_output(tcp);
+    }
+    void onReceived()
+    {
+        if(state == Greeting)
+        {
+            if(received.size() < sizeof(SessionHello) - 1)
+                return;
+            if(received.compare(0, sizeof(SessionHello) - 1, SessionHello) != 0)
+            {
+                unsupported();
+                return;
+            }
+            received.erase(0, sizeof(SessionHello) - 1);
+            state = Ready;
+            backoff = InitialBackoff;
+            if(hasPending)
+                sendPending();
+        }
+        if(received.empty())
+            return;
+        if(state != AwaitingAck || (received[0] != SessionAck && received[0] != SessionNak))
+        {
+            fail();
+            return;
+        }
+        bool successful = received[0] == SessionAck;
+        received.erase(0, 1);
+        state = Ready;
+        finishPending(successful);
+        if(!received.empty()) // acks for frames that weren't sent
+            fail();
+    }
+    static err_t receiveCallback(void * arg, tcp_pcb * tcp, pbuf * p, err_t err)
+    {
+        CollectorSession * me = (CollectorSession *)arg;
+        if(!me)
+        {
+            if(p)
+                pbuf_free(p);
+            tcp_abort(tcp);
+            return ERR_ABRT;
+        }
+        me->aborted = false;
+        if(!p) // the collector closed it
+        {
+            if(me->state == Greeting)
+                me->unsupported();
+            else
+            {
+                me->closeConnection(false);
+                me->state = Closed;
+                me->retryDelay = 0;
+                me->finishPending(false);
+            }
+            return me->aborted ? ERR_ABRT : ERR_OK;
+        }
+        size_t offset = me->received.size();
+        me->received.resize(offset + p->tot_len);
+        pbuf_copy_partial(p, &me->received[offset], p->tot_len, 0);
+        tcp_recved(tcp, p->tot_len);
+        pbuf_free(p);
+        me->onReceived();
+        return me->aborted ? ERR_ABRT : ERR_OK;
+    }
+    static err_t sentCallback(void * arg, tcp_pcb * tcp, u16_t)
+    {
+        CollectorSession * me = (CollectorSession *)arg;
+        if(me && me->state == AwaitingAck && me->amountSentAlready < me->frame.size())
+        {
+            me->queueChunk();
+            return tcp_output(tcp);
+        }
+        return ERR_OK;
+    }
+    static void errorCallback(void * arg, err_t)
+    {
+        CollectorSession * me = (CollectorSession *)arg;
+        if(!me)
+            return;
+        me->tcp = NULL; // lwIP has freed it already
+        me->fail();
+    }
+    static err_t connectedCallback(void * arg, tcp_pcb * tcp, err_t err)
+    {
+        CollectorSession * me = (CollectorSession *)arg;
+        if(err != ERR_OK)
+        {
+            me->fail();
+            return ERR_ABRT;
+        }
+        me->state = Greeting;
+        me->timer = 0;
+        tcp_write(tcp, SessionHello, sizeof(SessionHello) - 1, TCP_WRITE_FLAG_COPY);
+        return tcp_output(tcp);
+    }
+    void onGotIP()
+    {
+        printf("Opening session to %s:%u...\r\n", inet_ntoa(*(struct in_addr*)&ip), (unsigned)port);
+        tcp = tcp_new();
+        if(!tcp)
+        {
+            fail();
+            return;
+        }
+        tcp_arg(tcp, (void *)this);
+        tcp_err(tcp, &errorCallback);
+        tcp_recv(tcp, &receiveCallback);
+        tcp_sent(tcp, &sentCallback);
+        state = Connecting;
+        timer = 0;
+        if(ERR_OK != tcp_connect(tcp, &ip, port, &connectedCallback))
+            fail();
+    }
+    static void dnsResolveCallback(const char *, ip_addr * ipaddr, void * arg)
+    {
+        CollectorSession * me = (CollectorSession *)arg;
+        if(me->state != Resolving)
+            return;
+        if(!ipaddr || !ipaddr->addr)
+        {
+            me->fail();
+            return;
+        }
+        me->ip = *ipaddr;
+        me->onGotIP();
+    }
+    void connect()
+    {
+        state = Resolving;
+        timer = 0;
+        in_addr addr;
+        if(inet_aton(host.c_str(), &addr))
+        {
+            ip.addr = addr.s_addr;
+            onGotIP();
+            return;
+        }
+        switch(dns_gethostbyname(host.c_str(), &ip, &dnsResolveCallback, (void *)this))
+        {
+        case ERR_OK:
+            onGotIP();
+            return;
+        case ERR_INPROGRESS:
+            return;
+        default:
+            fail();
+            return;
+        }
+    }
+    CollectorSession(const CollectorSession &);
+    const CollectorSession & operator =(const CollectorSession &);
+public:
+    CollectorSession()
+        : port(0), tcp(NULL), state(Closed), amountSentAlready(0), hasPending(false), pendingCallback(NULL), pendingCallbackArg(NULL),
+          timer(0), retryDelay(0), backoff(InitialBackoff), aborted(false)
+    {
+        ip.addr = 0;
+    }
+    void setHost(string host, int port)
+    {
+        this->host = host;
+        this->port = port;
+    }
+    /** sends data as one frame, or through sendStringToHost if the collector doesn't do sessions.
+      * callback gets whether the collector acknowledged it.
+      */
+    void send(string data, void (*callback)(bool successful, void *), void * callbackArg)
+    {
+        if(state == Unsupported)
+        {
+            sendStringToHost(data, host, port, callback, callbackArg);
+            return;
+        }
+        if(hasPending || (state == Closed && retryDelay > 0)) // busy or backing off
+        {
+            if(callback)
+                callback(false, callbackArg);
+            return;
+        }
+        hasPending = true;
+        pendingData = data;
+        pendingCallback = callback;
+        pendingCallbackArg = callbackArg;
+        if(state == Ready)
+            sendPending();
+        else if(state == Closed)
+            connect();
+    }
+    void poll() // once a second
+    {
+        timer++;
+        switch(state)
+        {
+        case Closed:
+            if(retryDelay > 0)
+                retryDelay--;
+            break;
+        case Unsupported:
+            if(--retryDelay <= 0)
+                state = Closed;
+            break;
+        case Resolving:
+        case Connecting:
+            if(timer > ConnectTimeout)
+                fail();
+            break;
+        case Greeting:
+            if(timer > ConnectTimeout)
+                unsupported();
+            break;
+        case AwaitingAck:
+            if(timer > AckTimeout)
+                fail();
+            break;
+        case Ready:
+            break;
+        }
+    }
+};
+
+bool useCollectorSession = false;
+CollectorSession collectorSession;
+
 volatile int connectionsActive = 0;
 DigitalOut sending(LED3);
 
@@ -473,6 +830,15 @@ void onSendTick()
     canSend = true;
 }
 
+const float JournalFlushInterval = 30; // seconds, the LocalFileSystem is slow
+volatile bool canFlushJournal = false;
+bool journalFailed = false; // then only flush on the tick, /local is too slow to retry on every onIdle
+
+void onJournalTick()
+{
+    canFlushJournal = true;
+}
+
 void onIdle();
 
 void restartLink()
@@ -498,30 +864,51 @@ void restartLink()
     //printf("Interface is up, local IP is %s\r\n", inet_ntoa(*(struct in_addr*)&(netif->ip_addr))); 
 }
 
-const int EventLogSize = 20;
-deque<string> EventLog;
-volatile int sendingCount = 0;
-volatile int sentCount = 0;
+const size_t EventLogCapacity = 512; // 4K, a power of two
+const size_t MaxEventsPerBatch = 64;
+EventRing<EventLogCapacity> EventLog __attribute((section("AHBSRAM0"),aligned)); // AHBSRAM1 has the lwIP heap and Ethernet buffers, AHBSRAM0 is for USB, which isn't used
+EventJournal journal("/local", "ev");
+const size_t MaxBucketsPerBatch = 16;
+CrossingAggregator crossings;
+EventJournal countJournal("/local", "ct"); // the closed buckets; the open one is lost on a reset
+volatile bool sendingEvents = false;
+volatile bool sentEvents = false;
+uint32_t sendingEnd = 0; // EventLog sequence just after the batch being sent
+uint32_t sendingBucketEnd = 0; // the same for crossings.getBuckets()
 
-void addEvent(string event)
+/** what sendEvents sends, set by /local/upload.txt : "events", "counts" or "both", then the
+  * bucket width in seconds for the counts, then the BatchFormat, "text", "binary" or "base64".
+  * With counts only, a batch is the same size however busy the door is.
+  */
+enum UploadMode
 {
-    ostringstream os;
-    os << hex << time(NULL) << " " << event;
-    if(EventLog.size() >= EventLogSize)
+    UploadEvents,
+    UploadCounts,
+    UploadBoth
+};
+UploadMode uploadMode = UploadEvents;
+BatchFormat batchFormat = TextBatch;
+
+void addEvent(EventDirection direction)
+{
+    uint32_t now = (uint32_t)time(NULL);
+    if(uploadMode != UploadCounts)
     {
-        EventLog.pop_front();
+        EventRecord record = {now, direction, 0, 0};
+        journal.add(EventLog, record);
     }
-    EventLog.push_back(os.str());
+    if(uploadMode != UploadEvents)
+        crossings.add(direction, now);
 }
 
 void sendEventsCallback(bool successful, void *)
 {
     printf(successful ? "synced log\r\n" : "can't connect to log server\r\n");
     fflush(stdout);
-    if(successful && sendingCount > 0)
+    if(successful && sendingEvents)
     {
-        sentCount = sendingCount;
-        sendingCount = 0;
+        sentEvents = true;
+        sendingEvents = false;
     }
     if(--connectionsActive <= 0)
         sending = false;
@@ -530,23 +917,66 @@ void sendEventsCallback(bool successful, void *)
 string getStatsString()
 {
     ostringstream os;
-    os << hex << time(NULL) << "\n";
+    os << hex << time(NULL);
+    if(EventLog.getDroppedCount() > 0 || crossings.getBuckets().getDroppedCount() > 0) // since boot, because a ring was full and /local couldn't take them
+        os << " " << EventLog.getDroppedCount() << " " << crossings.getBuckets().getDroppedCount();
+    os << "\n";
     return os.str();
 }
 
 void sendString(string data);
 
+/** a TextBatch is the stats line :
+  *   <time> [<events dropped> <buckets dropped>]
+  * with the counts since boot only once a ring has overflowed, then a line per event :
+  *   <time> in|out [gap]
+  * and a line per closed bucket :
+  *   <start time> counts <width> <in count> <out count> <occupancy> [gap]
+  * all in hex. gap marks the first record after some were dropped. The other formats are in batch.h.
+  */
 void sendEvents()
 {
-    string data = getStatsString();
-    sendingCount = EventLog.size();
-    deque<string>::iterator iter = EventLog.begin();
-    for(int i = 0; i < sendingCount; i++)
+    uint32_t now = (uint32_t)time(NULL);
+    size_t count = EventLog.size();
+    if(count > MaxEventsPerBatch)
+        count = MaxEventsPerBatch;
+    crossings.closeBefore(now);
+    const CrossingAggregator::BucketRing & buckets = crossings.getBuckets();
+    size_t bucketCount = buckets.size();
+    if(bucketCount > MaxBucketsPerBatch)
+        bucketCount = MaxBucketsPerBatch;
+    sendingEnd = EventLog.getStartSequence() + count;
+    sendingBucketEnd = buckets.getStartSequence() + bucketCount;
+    sendingEvents = count > 0 || bucketCount > 0;
+    if(batchFormat != TextBatch)
     {
-        data += *iter++;
-        data += "\n";
+        string batch;
+        appendBinaryBatch(batch, now, EventLog, count, buckets, bucketCount);
+        if(batchFormat == Base64Batch)
+        {
+            string framed(1, Base64BatchMarker);
+            appendBase64Bytes(framed, (const uint8_t *)batch.data(), batch.size());
+            framed += "\n";
+            batch.swap(framed);
+        }
+        sendString(batch);
+        return;
     }
-    sendString(data);
+    ostringstream os;
+    os << getStatsString() << hex;
+    for(size_t i = 0; i < count; i++)
+    {
+        const EventRecord & record = EventLog[i];
+        os << (time_t)record.time << (record.direction == EventIn ? " in" : " out")
+           << ((record.flags & EventAfterGap) ? " gap\n" : "\n");
+    }
+    for(size_t i = 0; i < bucketCount; i++)
+    {
+        const CountBucket & bucket = buckets[i];
+        os << (time_t)bucket.startTime << " counts " << bucket.width << " " << bucket.inCount << " "
+           << bucket.outCount << " " << bucket.occupancy << ((bucket.flags & EventAfterGap) ? " gap\n" : "\n");
+    }
+    sendString(os.str());
 }
 
 volatile bool canRunLEDSense = false;
@@ -674,20 +1104,20 @@ DigitalOut sensorLEDPower(p23);
 SingleSensorChannel outsideSensor(p15, LED4);
 SingleSensorChannel insideSensor(p16, LED1);
 
-void addEvent(string msg);
+void addEvent(EventDirection direction);
 
 void onGoInside()
 {
     printf("went inside\r\n");
     fflush(stdout);
-    addEvent("in");
+    addEvent(EventIn);
 }
 
 void onGoOutside()
 {
     printf("went outside\r\n");
     fflush(stdout);
-    addEvent("out");
+    addEvent(EventOut);
 }
 
 enum SensorStateType
@@ -865,14 +1295,24 @@ void onIdle()
     {
         canPoll = false;
         SendStringToHostHelper::poll();
+        collectorSession.poll();
     }
     ipUp = netif_is_up(&netif_data) && netif_is_link_up(&netif_data);
-    if(sentCount > 0)
+    if(sentEvents)
     {
-        while(sentCount-- > 0)
-        {
-            EventLog.pop_front();
-        }
+        sentEvents = false;
+        journal.acknowledge(EventLog, sendingEnd);
+        countJournal.acknowledge(crossings.getBuckets(), sendingBucketEnd);
+    }
+    // a busy door can fill the ring before the next tick, so write early when half of it is unsaved
+    if(canFlushJournal || (!journalFailed && (journal.getUnwrittenCount(EventLog) >= EventLogCapacity / 2
+                                              || countJournal.getUnwrittenCount(crossings.getBuckets()) >= CrossingAggregator::ClosedBucketCapacity / 2)))
+    {
+        canFlushJournal = false;
+        Watchdog::kick();
+        journalFailed = !journal.flush(EventLog);
+        Watchdog::kick();
+        journalFailed = !countJournal.flush(crossings.getBuckets()) || journalFailed;
     }
     if(ipUp)
         getTime();
@@ -918,7 +1358,7 @@ void onIdle()
     if(gotTime)
     {
         runLEDSense();
-        if((canSend || EventLog.size() > EventLogSize / 2) && !sending && startupState == Running)
+        if((canSend || EventLog.size() >= MaxEventsPerBatch) && !sending && startupState == Running)
         {
             canSend = false;
             sendEvents();
@@ -968,8 +1408,35 @@ void stopInternet()
 
 BigUnsigned encryptionModulus = (WordType)0;
 BigUnsigned encryptionExponent = (WordType)0x10001;
+RSAPublicKey * encryptionKey = NULL;
+char payloadVersion = ChunkedPayloadVersion; // set by /local/payload.txt, see payload.h. Only send '2' or '3' once the collector can decode it
+const bool SaveEncryptionKeyContext = true; // keep the precomputed key values in /local/enc-key.ctx so later boots skip computing them
 string deviceName = "people-counter";
 
+void loadEncryptionKey()
+{
+    {
+        ifstream is("/local/enc-key.ctx");
+        if(is)
+        {
+            encryptionKey = RSAPublicKey::load(is, encryptionModulus, encryptionExponent);
+            is.close();
+        }
+    }
+    if(encryptionKey)
+        return;
+    encryptionKey = new RSAPublicKey(encryptionModulus, encryptionExponent);
+    if(SaveEncryptionKeyContext)
+    {
+        ofstream os("/local/enc-key.ctx");
+        if(os)
+        {
+            encryptionKey->save(os);
+            os.close();
+        }
+    }
+}
+
 void loadSettings()
 {
     {
@@ -978,6 +1445,8 @@ void loadSettings()
         {
             getline(is, HostName);
             is >> HostPort;
+            string mode;
+            useCollectorSession = (is >> mode) && mode == "session";
             is.close(); 
         }
     }
@@ -989,13 +1458,14 @@ void loadSettings()
             is >> key;
             is.close();
             encryptionModulus = BigUnsigned::parseHexByteString(key);
-            if(encryptionModulus == (WordType)0)
+            if(encryptionModulus <= (WordType)1 || ((WordType)encryptionModulus & 1) == 0 || encryptionModulus.bitLength() > MaxEncryptionKeyBits)
             {
                 printf("invalid encryption modulus\r\n");
                 fflush(stdout);
                 while(true)
                     ;
             }
+            loadEncryptionKey();
         }        
     }
     {
@@ -1005,49 +1475,80 @@ void loadSettings()
             is >> deviceName;
         }
     }
-}
-
-WordType randomEngine()
-{
-    WordType v = rand() & 0xFF;
-    for(size_t i = 1; i < BytesPerWord; i++)
     {
-        v <<= 8;
-        v |= rand() & 0xFF;
+        ifstream is("/local/upload.txt");
+        if(is)
+        {
+            string mode, format;
+            unsigned bucketWidth = 60;
+            is >> mode >> bucketWidth >> format;
+            if(mode == "counts")
+                uploadMode = UploadCounts;
+            else if(mode == "both")
+                uploadMode = UploadBoth;
+            else
+                uploadMode = UploadEvents;
+            if(bucketWidth < 1 || bucketWidth > 0xFFFF)
+                bucketWidth = 60;
+            crossings.setBucketWidth((uint16_t)bucketWidth);
+            if(format == "binary")
+                batchFormat = BinaryBatch;
+            else if(format == "base64")
+                batchFormat = Base64Batch;
+            else
+                batchFormat = TextBatch;
+        }
+    }
+    {
+        ifstream is("/local/payload.txt");
+        char version;
+        if(is >> version)
+        {
+            if(version == ChunkedPayloadVersion || version == PackedPayloadVersion || version == HybridPayloadVersion)
+                payloadVersion = version;
+            else
+                printf("unknown payload version %c, sending version %c\r\n", version, payloadVersion);
+        }
     }
-    return v;
 }
 
-BigUnsigned randomBits(size_t bitCount)
+/** seeds randomGenerator at boot from the RTC, the MAC address and the low bits of the
+  * sensor ADCs, which are mostly noise. The time from the time server is added when it comes.
+  */
+void seedRandomGenerator()
 {
-    BigUnsigned retval = randomEngine() & (((WordType)1 << (bitCount % BitsPerWord)) - 1);
-    for(size_t i = BitsPerWord; i < bitCount; i += BitsPerWord)
+    time_t now = time(NULL);
+    randomGenerator.addEntropy(&now, sizeof(now));
+    char mac[6];
+    device_address(mac);
+    randomGenerator.addEntropy(mac, sizeof(mac));
+    const size_t SampleCount = 64;
+    uint16_t samples[2 * SampleCount];
+    for(size_t i = 0; i < SampleCount; i++)
     {
-        retval <<= BitsPerWord;
-        retval += randomEngine();
-    }    
-    return retval;
+        samples[2 * i] = outsideSensor.sensor.read_u16();
+        samples[2 * i + 1] = insideSensor.sensor.read_u16();
+    }
+    randomGenerator.addEntropy(samples, sizeof(samples));
+    addTimerEntropy();
 }
 
 string encryptString(string textIn)
 {
-    if(encryptionModulus == (WordType)0)
-        return "0" + textIn;
-    string retval = "1";
-    const size_t encryptChunkSize = 32;
-    printf("encryptString\r\ntextIn : %s\r\n", textIn.c_str());
-    for(size_t i = 0; i < textIn.size(); i += encryptChunkSize)
-    {
-        const size_t randomBitCount = 64;
-        const WordType checkSumModulus = 8191;
-        BigUnsigned v = BigUnsigned::fromByteString(textIn.substr(i, encryptChunkSize));
-        v = (v << randomBitCount) + randomBits(randomBitCount);
-        WordType checkSum = (WordType)(v % checkSumModulus);
-        v *= checkSumModulus;
-        v += checkSum;
-        v = powMod(v, encryptionExponent, encryptionModulus);
-        retval += v.toBase64() + "\n"; 
-    }
+    if(!encryptionKey)
+        return encryptPayload(textIn, NULL, PlainPayloadVersion, randomGenerator);
+    if(batchFormat == TextBatch)
+        printf("encryptString\r\ntextIn : %s\r\n", textIn.c_str());
+    else // binary batches would garble the console
+        printf("encryptString\r\ntextIn : %u bytes\r\n", (unsigned)textIn.size());
+#ifdef BIGMATH_PROFILE
+    resetBigMathProfile();
+#endif
+    addTimerEntropy();
+    string retval = encryptPayload(textIn, encryptionKey, payloadVersion, randomGenerator);
+#ifdef BIGMATH_PROFILE
+    printBigMathProfile(getBigMathProfile());
+#endif
     return retval;
 }
 
@@ -1057,12 +1558,26 @@ void sendString(string data)
     data = encryptString(data);
     connectionsActive++;
     sending = true;
-    sendStringToHost(data, HostName, HostPort, &sendEventsCallback, NULL);
+    if(useCollectorSession)
+    {
+        collectorSession.setHost(HostName, HostPort);
+        collectorSession.send(data, &sendEventsCallback, NULL);
+    }
+    else
+        sendStringToHost(data, HostName, HostPort, &sendEventsCallback, NULL);
 }
 
 int main() 
 {
+    entropyTimer.start();
+    seedRandomGenerator();
     loadSettings();
+    journal.replay(EventLog);
+    crossings.setJournal(&countJournal);
+    CountBucket lastBucket;
+    lastBucket.occupancy = 0;
+    countJournal.replay(crossings.getBuckets(), &lastBucket);
+    crossings.setOccupancy(lastBucket.occupancy);
     Watchdog::kick(3);
     printf("\x1b[2J\x1b[H");
     fflush(stdout);
@@ -1086,8 +1601,9 @@ int main()
     startInternet();
 
     //printf("Interface is up, local IP is %s\r\n", inet_ntoa(*(struct in_addr*)&(netif->ip_addr))); 
-    Ticker tickSend;
+    Ticker tickSend, tickJournal;
     tickSend.attach(&onSendTick, 10);
+    tickJournal.attach(&onJournalTick, JournalFlushInterval);
     canSend = false;
     while(1) 
     {
@@ -0,0 +1,218 @@
+#include "payload.h"
+#include "chacha.h"
+#include <cstring>
+
+const size_t EncryptChunkSize = 32;
+const size_t RandomBitCount = 64;
+const WordType CheckSumModulus = 8191;
+const size_t CheckSumBits = 13;
+
+size_t getPackedChunkSize(const BigUnsigned & modulus)
+{
+    // the block is (1 byte marker bit + bytes) << RandomBitCount, times the checksum modulus plus
+    // the checksum, which has fewer bits than the modulus if it fits in bitLength - 1 bits
+    size_t overheadBits = 1 + RandomBitCount + CheckSumBits;
+    size_t bitLength = modulus.bitLength();
+    if(bitLength < overheadBits + 1 + 8)
+        handleError("modulus too small in getPackedChunkSize");
+    return (bitLength - 1 - overheadBits) / 8;
+}
+
+static EncryptionBlock randomBits(size_t bitCount, RandomGenerator & random) // at most RandomBitCount bits
+{
+    WordType words[(RandomBitCount + BitsPerWord - 1) / BitsPerWord];
+    size_t wordCount = (bitCount + BitsPerWord - 1) / BitsPerWord;
+    random.fillWords(words, wordCount);
+    if(bitCount % BitsPerWord != 0)
+        words[wordCount - 1] &= ((WordType)1 << (bitCount % BitsPerWord)) - 1;
+    return EncryptionBlock::fromWords(words, wordCount);
+}
+
+static void appendEncryptedBlock(string & dest, const RSAPublicKey & key, const string & bytes, size_t offset, size_t count, RandomGenerator & random)
+{
+    static const WordBarrettReducer checkSumReducer(CheckSumModulus);
+    EncryptionBlock v = EncryptionBlock::fromByteString(bytes, offset, count);
+    v <<= RandomBitCount;
+    v += randomBits(RandomBitCount, random);
+    WordType checkSum = checkSumReducer.reduce(v.getWords(), v.getWordCount());
+    v *= CheckSumModulus;
+    v += checkSum;
+    v = key.encrypt(v);
+    v.appendBase64(dest);
+    dest += "\n";
+}
+
+static bool isBase64(const string & str)
+{
+    if(str.empty())
+        return false;
+    for(size_t i = 0; i < str.size(); i++)
+    {
+        if(!isalnum(str[i]) && str[i] != '+' && str[i] != '/')
+            return false;
+    }
+    return true;
+}
+
+static bool decryptBlock(const string & line, const RSAPrivateKey & key, string & bytes)
+{
+    if(!isBase64(line))
+        return false;
+    BigUnsigned v = BigUnsigned::parseBase64(line);
+    if(v >= key.getModulus())
+        return false;
+    v = key.decrypt(v);
+    BigUnsigned withRandomBits;
+    WordType checkSum;
+    divModInto(withRandomBits, checkSum, v, CheckSumModulus);
+    if(withRandomBits % CheckSumModulus != checkSum)
+        return false;
+    v = withRandomBits >> RandomBitCount;
+    if(v == (WordType)0 || (v.bitLength() - 1) % 8 != 0) // not a byte string
+        return false;
+    bytes = v.toByteString();
+    return true;
+}
+
+static const char Base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void appendBase64Bytes(string & dest, const uint8_t bytes[], size_t size)
+{
+    dest.reserve(dest.size() + (size + 2) / 3 * 4);
+    for(size_t i = 0; i < size; i += 3)
+    {
+        uint32_t group = (uint32_t)bytes[i] << 16;
+        if(i + 1 < size)
+            group |= (uint32_t)bytes[i + 1] << 8;
+        if(i + 2 < size)
+            group |= bytes[i + 2];
+        dest += Base64Digits[group >> 18];
+        dest += Base64Digits[(group >> 12) & 0x3F];
+        dest += i + 1 < size ? Base64Digits[(group >> 6) & 0x3F] : '=';
+        dest += i + 2 < size ? Base64Digits[group & 0x3F] : '=';
+    }
+}
+
+bool parseBase64Bytes(const string & str, vector<uint8_t> & bytes)
+{
+    if(str.size() % 4 != 0)
+        return false;
+    bytes.clear();
+    bytes.reserve(str.size() / 4 * 3);
+    for(size_t i = 0; i < str.size(); i += 4)
+    {
+        uint32_t group = 0;
+        size_t digitCount = 0;
+        for(size_t j = 0; j < 4; j++)
+        {
+            const char * digit = str[i + j] != '\0' ? strchr(Base64Digits, str[i + j]) : NULL;
+            if(digit)
+            {
+                if(digitCount != j) // digits after padding
+                    return false;
+                digitCount++;
+            }
+            else if(str[i + j] != '=' || j < 2 || i + 4 != str.size())
+                return false;
+            group = (group << 6) | (digit ? digit - Base64Digits : 0);
+        }
+        bytes.push_back((uint8_t)(group >> 16));
+        if(digitCount > 2)
+            bytes.push_back((uint8_t)(group >> 8));
+        if(digitCount > 3)
+            bytes.push_back((uint8_t)group);
+    }
+    return true;
+}
+
+static void encryptHybrid(string & dest, const string & text, const RSAPublicKey & key, RandomGenerator & random)
+{
+    string sessionKey(ChaChaKeySize, '\0');
+    random.fillBytes((uint8_t *)&sessionKey[0], ChaChaKeySize);
+    appendEncryptedBlock(dest, key, sessionKey, 0, ChaChaKeySize, random);
+    // each session key encrypts one message, so a fixed nonce is safe
+    const uint8_t nonce[ChaChaNonceSize] = {0};
+    vector<uint8_t> body(text.size() + Poly1305TagSize);
+    memcpy(&body[0], text.data(), text.size());
+    chacha20Poly1305Seal(&body[0], text.size(), (const uint8_t *)dest.data(), dest.size(),
+                         (const uint8_t *)sessionKey.data(), nonce, &body[text.size()]);
+    sessionKey.assign(ChaChaKeySize, '\0');
+    appendBase64Bytes(dest, &body[0], body.size());
+    dest += "\n";
+}
+
+string encryptPayload(const string & text, const RSAPublicKey * key, char version, RandomGenerator & random)
+{
+    if(!key || version == PlainPayloadVersion)
+        return PlainPayloadVersion + text;
+    string retval(1, version);
+    size_t blockDigits = (key->getModulus().bitLength() + 5) / 6 + 1;
+    if(version == HybridPayloadVersion)
+    {
+        retval.reserve(1 + blockDigits + (text.size() + Poly1305TagSize + 2) / 3 * 4 + 1);
+        encryptHybrid(retval, text, *key, random);
+        return retval;
+    }
+    size_t chunkSize = EncryptChunkSize;
+    if(version == PackedPayloadVersion)
+        chunkSize = getPackedChunkSize(key->getModulus());
+    else if(version != ChunkedPayloadVersion)
+        handleError("unknown version in encryptPayload");
+    size_t chunkCount = (text.size() + chunkSize - 1) / chunkSize;
+    retval.reserve(1 + chunkCount * blockDigits);
+    for(size_t i = 0; i < text.size(); i += chunkSize)
+        appendEncryptedBlock(retval, *key, text, i, chunkSize, random);
+    return retval;
+}
+
+static bool decryptHybrid(const string & payload, const RSAPrivateKey & key, string & text)
+{
+    size_t keyLineEnd = payload.find('\n');
+    if(keyLineEnd == string::npos || payload.empty() || payload[payload.size() - 1] != '\n')
+        return false;
+    string sessionKey;
+    if(!decryptBlock(payload.substr(1, keyLineEnd - 1), key, sessionKey) || sessionKey.size() != ChaChaKeySize)
+        return false;
+    size_t bodyStart = keyLineEnd + 1;
+    vector<uint8_t> body;
+    if(!parseBase64Bytes(payload.substr(bodyStart, payload.size() - 1 - bodyStart), body) || body.size() < Poly1305TagSize)
+        return false;
+    const uint8_t nonce[ChaChaNonceSize] = {0};
+    size_t textSize = body.size() - Poly1305TagSize;
+    if(!chacha20Poly1305Open(&body[0], textSize, (const uint8_t *)payload.data(), bodyStart,
+                             (const uint8_t *)sessionKey.data(), nonce, &body[textSize]))
+        return false;
+    text.assign((const char *)&body[0], textSize);
+    return true;
+}
+
+bool decryptPayload(const string & payload, const RSAPrivateKey & key, string & text)
+{
+    if(payload.empty())
+        return false;
+    if(payload[0] == PlainPayloadVersion)
+    {
+        text = payload.substr(1);
+        return true;
+    }
+    if(payload[0] == HybridPayloadVersion)
+        return decryptHybrid(payload, key, text);
+    size_t chunkSize = EncryptChunkSize;
+    if(payload[0] == PackedPayloadVersion)
+        chunkSize = getPackedChunkSize(key.getModulus());
+    else if(payload[0] != ChunkedPayloadVersion)
+        return false;
+    text.clear();
+    for(size_t start = 1; start < payload.size();)
+    {
+        size_t end = payload.find('\n', start);
+        if(end == string::npos)
+            return false;
+        string chunk;
+        if(!decryptBlock(payload.substr(start, end - start), key, chunk) || chunk.size() > chunkSize)
+            return false;
+        text += chunk;
+        start = end + 1;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include "rsa.h"
+#include "prng.h"
+#include <string>
+
+/** what sendString sends, told apart by its first character :
+  *   '0' the text as it is, when there's no key.
+  *   '1' the text in 32 byte chunks, each RSA encrypted by itself and base64 encoded on a line of its own.
+  *   '2' a random session key RSA encrypted on the first line, then the text encrypted with
+  *       ChaCha20-Poly1305 under that key and base64 encoded on the second. One RSA operation per batch
+  *       instead of one per chunk. The tag also covers the version and the key line.
+  *   '3' like '1', but each chunk is as big as the key allows, getPackedChunkSize bytes instead of 32.
+  * RSA blocks hold their bytes as a byte string followed by 64 random bits and a mod 8191 checksum.
+  */
+const char PlainPayloadVersion = '0';
+const char ChunkedPayloadVersion = '1';
+const char HybridPayloadVersion = '2';
+const char PackedPayloadVersion = '3';
+
+const size_t MaxEncryptionKeyBits = 4096;
+typedef FixedBigUnsigned<MaxEncryptionKeyBits / BitsPerWord> EncryptionBlock; // one RSA block, kept off the heap
+
+size_t getPackedChunkSize(const BigUnsigned & modulus); // the most bytes an RSA block can hold with this modulus
+
+string encryptPayload(const string & text, const RSAPublicKey * key, char version, RandomGenerator & random); // a NULL key gives version 0
+/** ordinary base64 of bytes, unlike the numbers in RSA blocks. Used for the body of a hybrid
+  * payload and for base64 framed batches.
+  */
+void appendBase64Bytes(string & dest, const uint8_t bytes[], size_t size);
+bool parseBase64Bytes(const string & str, vector<uint8_t> & bytes);
+
+/** the collector's side, for any version. Returns false if the payload is malformed,
+  * was encrypted for a different key or fails its checksums or tag.
+  */
+bool decryptPayload(const string & payload, const RSAPrivateKey & key, string & text);
+
+#endif
@@ -0,0 +1,59 @@
+#include "prng.h"
+#include <cstring>
+
+// separate nonces so the blocks that mix in entropy never equal output blocks
+static const uint8_t OutputNonce[ChaChaNonceSize] = {0};
+static const uint8_t MixNonce[ChaChaNonceSize] = {1};
+
+RandomGenerator::RandomGenerator()
+    : bufferUsed(BufferSize)
+{
+    memset(key, 0, sizeof(key));
+}
+
+RandomGenerator::~RandomGenerator()
+{
+    memset(key, 0, sizeof(key));
+    memset(buffer, 0, sizeof(buffer));
+}
+
+void RandomGenerator::refill()
+{
+    for(size_t i = 0; i < BufferSize / BlockSize; i++)
+        chacha20Block(&buffer[i * BlockSize], key, (uint32_t)i, OutputNonce);
+    memcpy(key, buffer, ChaChaKeySize);
+    memset(buffer, 0, ChaChaKeySize);
+    bufferUsed = ChaChaKeySize;
+}
+
+void RandomGenerator::addEntropy(const void * data, size_t size)
+{
+    const uint8_t * bytes = (const uint8_t *)data;
+    uint8_t block[BlockSize];
+    for(size_t i = 0; i < size; i += ChaChaKeySize)
+    {
+        for(size_t j = 0; j < ChaChaKeySize && i + j < size; j++)
+            key[j] ^= bytes[i + j];
+        chacha20Block(block, key, 0, MixNonce);
+        memcpy(key, block, ChaChaKeySize);
+    }
+    memset(block, 0, sizeof(block));
+    bufferUsed = BufferSize; // drop output made with the old key
+}
+
+void RandomGenerator::fillBytes(uint8_t dest[], size_t size)
+{
+    while(size > 0)
+    {
+        if(bufferUsed == BufferSize)
+            refill();
+        size_t count = BufferSize - bufferUsed;
+        if(count > size)
+            count = size;
+        memcpy(dest, &buffer[bufferUsed], count);
+        memset(&buffer[bufferUsed], 0, count);
+        bufferUsed += count;
+        dest += count;
+        size -= count;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef PRNG_H
+#define PRNG_H
+
+#include "bigmath.h"
+#include "chacha.h"
+
+/** random numbers for the payload padding and session keys. The output is the ChaCha20
+  * keystream, a few hundred bytes per refill. The first 32 bytes of every refill replace
+  * the key, so output that was already used can't be worked back out of the state.
+  * addEntropy folds seed material (time, MAC address, ADC noise) into the key; until
+  * something has been added the output is the same on every boot.
+  */
+class RandomGenerator
+{
+    enum {BlockSize = 64, BufferSize = 4 * BlockSize};
+    uint8_t key[ChaChaKeySize];
+    uint8_t buffer[BufferSize];
+    size_t bufferUsed;
+    void refill();
+    RandomGenerator(const RandomGenerator &);
+    const RandomGenerator & operator =(const RandomGenerator &);
+public:
+    RandomGenerator();
+    ~RandomGenerator();
+    void addEntropy(const void * data, size_t size);
+    void fillBytes(uint8_t dest[], size_t size);
+    void fillWords(WordType dest[], size_t count)
+    {
+        fillBytes((uint8_t *)dest, count * sizeof(WordType));
+    }
+    WordType nextWord()
+    {
+        WordType retval;
+        fillWords(&retval, 1);
+        return retval;
+    }
+};
+
+#endif
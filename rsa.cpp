@@ -0,0 +1,50 @@
+#include "rsa.h"
+#include <string>
+
+/** R ^ 2 mod modulus depends on the word size, since R = 2 ^ (BitsPerWord * words in modulus).
+  * Files always hold it for 32 bit words, so keys saved on the device load on a 64 bit host and the other way around.
+  */
+const size_t SavedWordBits = 32;
+
+static size_t getSavedRBits(const BigUnsigned & modulus)
+{
+    return (modulus.bitLength() + SavedWordBits - 1) / SavedWordBits * SavedWordBits;
+}
+
+RSAPublicKey * RSAPublicKey::load(istream & is, BigUnsigned modulus, BigUnsigned exponent)
+{
+    string modulusString, exponentString, rSquaredString;
+    if(!(is >> modulusString >> exponentString >> rSquaredString))
+        return NULL;
+    if(BigUnsigned::parseHexByteString(modulusString) != modulus)
+        return NULL;
+    if(BigUnsigned::parseHexByteString(exponentString) != exponent)
+        return NULL;
+    BigUnsigned rSquared = BigUnsigned::parseHexByteString(rSquaredString);
+    if(rSquared >= modulus)
+        return NULL;
+    size_t rBits = BitsPerWord * modulus.getWordCount(), savedRBits = getSavedRBits(modulus);
+    if(rBits != savedRBits)
+        rSquared = (rSquared << 2 * (rBits - savedRBits)) % modulus;
+    RSAPublicKey * retval = new RSAPublicKey(modulus, exponent, rSquared);
+    // a file cut short by a reset in save() still parses, so check it really is R ^ 2 : the
+    // round trip gives 2 * rSquared / R ^ 2 mod modulus, which is 2 only for the right value
+    const BigUnsigned two(2);
+    if(retval->context.fromMontgomery(retval->context.toMontgomery(two)) != two)
+    {
+        delete retval;
+        return NULL;
+    }
+    return retval;
+}
+
+void RSAPublicKey::save(ostream & os) const
+{
+    os << getModulus().toHexByteString() << "\n";
+    os << exponent.toHexByteString() << "\n";
+    size_t rBits = BitsPerWord * context.getSize(), savedRBits = getSavedRBits(getModulus());
+    if(rBits == savedRBits)
+        os << context.getRSquared().toHexByteString() << "\n";
+    else
+        os << ((BigUnsigned(1) << 2 * savedRBits) % getModulus()).toHexByteString() << "\n";
+}
@@ -0,0 +1,74 @@
+#ifndef RSA_H
+#define RSA_H
+
+#include "bigmath.h"
+#include <istream>
+#include <ostream>
+
+/** an RSA public key along with everything that only depends on the key,
+  * so encrypting a block only does the per-block work.
+  */
+class RSAPublicKey
+{
+    BigUnsigned exponent;
+    ExponentChain exponentChain;
+    MontgomeryContext context;
+    mutable vector<WordType> scratch; // powMod scratch, allocated once so encrypting a FixedBigUnsigned doesn't allocate
+public:
+    RSAPublicKey(BigUnsigned modulus, BigUnsigned exponent)
+        : exponent(exponent), exponentChain(exponent), context(modulus), scratch(context.getPowModScratchSize(exponentChain))
+    {
+    }
+    RSAPublicKey(BigUnsigned modulus, BigUnsigned exponent, BigUnsigned rSquared)
+        : exponent(exponent), exponentChain(exponent), context(modulus, rSquared), scratch(context.getPowModScratchSize(exponentChain))
+    {
+    }
+    const BigUnsigned & getModulus() const
+    {
+        return context.getModulus();
+    }
+    const BigUnsigned & getExponent() const
+    {
+        return exponent;
+    }
+    const MontgomeryContext & getContext() const
+    {
+        return context;
+    }
+    BigUnsigned encrypt(BigUnsigned v) const
+    {
+        return powMod(v, exponentChain, context);
+    }
+    template <size_t Words>
+    FixedBigUnsigned<Words> encrypt(const FixedBigUnsigned<Words> & v) const
+    {
+        return powMod(v, exponentChain, context, &scratch[0]);
+    }
+    /** read the precomputed values written by save.
+      * returns NULL if they are missing or were computed for a different key.
+      */
+    static RSAPublicKey * load(istream & is, BigUnsigned modulus, BigUnsigned exponent);
+    void save(ostream & os) const;
+};
+
+/** the collector's key, for reading what devices send */
+class RSAPrivateKey
+{
+    ExponentChain exponentChain;
+    MontgomeryContext context;
+public:
+    RSAPrivateKey(BigUnsigned modulus, BigUnsigned privateExponent)
+        : exponentChain(privateExponent), context(modulus)
+    {
+    }
+    const BigUnsigned & getModulus() const
+    {
+        return context.getModulus();
+    }
+    BigUnsigned decrypt(BigUnsigned v) const
+    {
+        return powMod(v, exponentChain, context);
+    }
+};
+
+#endif
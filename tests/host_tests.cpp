@@ -0,0 +1,389 @@
+// host tests for the parts that don't need the board : make check
+// ChaCha20, Poly1305 and the AEAD against the vectors in RFC 8439 sections 2.3.2, 2.5.2 and 2.8.2,
+// encryptPayload against decryptPayload for every version, the journal replaying and refilling a
+// ring, and binary batches through decodeBatch. The journal files go in tests/ and are removed after.
+#include "chacha.h"
+#include "payload.h"
+#include "batch.h"
+#include "journal.h"
+#include "aggregate.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+static int failureCount = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char * text, int line)
+{
+    if(condition)
+        return;
+    cout << "line " << line << " : " << text << endl;
+    failureCount++;
+}
+
+static string toHex(const uint8_t bytes[], size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    string retval;
+    for(size_t i = 0; i < size; i++)
+    {
+        retval += digits[bytes[i] >> 4];
+        retval += digits[bytes[i] & 0xF];
+    }
+    return retval;
+}
+
+static void testChaCha20Block() // RFC 8439 2.3.2
+{
+    uint8_t key[ChaChaKeySize];
+    for(size_t i = 0; i < ChaChaKeySize; i++)
+        key[i] = (uint8_t)i;
+    const uint8_t nonce[ChaChaNonceSize] = {0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00};
+    uint8_t block[64];
+    chacha20Block(block, key, 1, nonce);
+    CHECK(toHex(block, sizeof(block)) ==
+          "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+          "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e");
+}
+
+static void testPoly1305() // RFC 8439 2.5.2
+{
+    const uint8_t key[Poly1305KeySize] =
+    {
+        0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+        0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+    };
+    const char * message = "Cryptographic Forum Research Group";
+    uint8_t tag[Poly1305TagSize];
+    Poly1305 mac(key);
+    mac.update((const uint8_t *)message, 10); // in two parts, to go through the buffer
+    mac.update((const uint8_t *)message + 10, strlen(message) - 10);
+    mac.finish(tag);
+    CHECK(toHex(tag, sizeof(tag)) == "a8061dc1305136c6c22b8baf0c0127a9");
+}
+
+static void testChaCha20Poly1305() // RFC 8439 2.8.2
+{
+    string plainText = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+    const uint8_t aad[] = {0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7};
+    uint8_t key[ChaChaKeySize];
+    for(size_t i = 0; i < ChaChaKeySize; i++)
+        key[i] = (uint8_t)(0x80 + i);
+    const uint8_t nonce[ChaChaNonceSize] = {0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47};
+    vector<uint8_t> data(plainText.begin(), plainText.end());
+    uint8_t tag[Poly1305TagSize];
+    chacha20Poly1305Seal(&data[0], data.size(), aad, sizeof(aad), key, nonce, tag);
+    CHECK(toHex(&data[0], data.size()) ==
+          "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+          "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+          "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+          "3ff4def08e4b7a9de576d26586cec64b6116");
+    CHECK(toHex(tag, sizeof(tag)) == "1ae10b594f09e26a7e902ecbd0600691");
+    data[5] ^= 1;
+    CHECK(!chacha20Poly1305Open(&data[0], data.size(), aad, sizeof(aad), key, nonce, tag));
+    data[5] ^= 1;
+    CHECK(chacha20Poly1305Open(&data[0], data.size(), aad, sizeof(aad), key, nonce, tag));
+    CHECK(string(data.begin(), data.end()) == plainText);
+}
+
+// a 1024 bit test key, public exponent 65537, in the format of /local/enc-key.txt
+static const char * TestModulus =
+    "de:04:9b:d8:b3:54:eb:62:d7:94:a6:47:b9:50:38:2e:2f:79:b7:b9:bc:1e:cc:88:"
+    "0d:14:6e:cc:cc:3d:9d:bf:e8:4d:32:8d:c2:62:8c:a6:14:0b:34:8e:d1:68:42:01:"
+    "1a:1e:f6:df:28:76:83:46:52:a0:8e:b0:ac:95:1e:e4:7e:5f:c5:02:2c:8d:d7:53:"
+    "6f:85:bb:42:ab:39:7d:15:f9:64:c4:bf:ca:8d:73:92:17:d6:44:4d:a2:ac:fb:a9:"
+    "22:26:a3:48:7a:28:bc:8a:63:27:ee:b4:65:c9:e8:9f:3c:41:69:81:8f:d4:60:d4:"
+    "97:db:87:97:ea:1d:a9:e5";
+static const char * TestPrivateExponent =
+    "06:b8:9c:ff:32:6e:9f:b1:9e:55:21:b3:8a:28:a3:8a:c2:65:2c:ea:b2:87:3c:29:"
+    "e2:3b:7c:1f:37:0f:a6:76:e8:d1:6d:76:5d:2c:1e:95:e8:85:6e:51:e4:85:03:7a:"
+    "85:0f:ea:e9:56:90:3f:e9:21:17:3b:3a:9d:fe:e5:b0:76:af:fc:c2:4f:f9:8d:bb:"
+    "86:07:a3:be:c4:dc:da:93:a1:bb:7b:40:60:4a:29:d8:13:36:ae:6c:35:fa:b4:df:"
+    "bf:de:ee:18:71:67:6d:7c:7f:5a:89:97:46:90:82:b2:75:b8:9d:de:a2:7e:bf:02:"
+    "09:77:f2:53:37:6d:58:01";
+
+static void testPayloadRoundTrip()
+{
+    BigUnsigned modulus = BigUnsigned::parseHexByteString(TestModulus);
+    RSAPublicKey publicKey(modulus, BigUnsigned(0x10001));
+    RSAPrivateKey privateKey(modulus, BigUnsigned::parseHexByteString(TestPrivateExponent));
+    RandomGenerator random;
+    string text = "door1\n";
+    for(int i = 0; i < 300; i++)
+        text += (char)(i * 7); // binary, zero bytes included, and several chunks long
+    const char versions[] = {PlainPayloadVersion, ChunkedPayloadVersion, HybridPayloadVersion, PackedPayloadVersion};
+    for(size_t i = 0; i < sizeof(versions); i++)
+    {
+        string payload = encryptPayload(text, versions[i] == PlainPayloadVersion ? NULL : &publicKey, versions[i], random);
+        CHECK(!payload.empty() && payload[0] == versions[i]);
+        string decrypted;
+        CHECK(decryptPayload(payload, privateKey, decrypted));
+        CHECK(decrypted == text);
+        if(versions[i] == HybridPayloadVersion)
+        {
+            payload[payload.size() / 2 + 40] ^= 1; // in the body, which the tag covers
+            CHECK(!decryptPayload(payload, privateKey, decrypted));
+        }
+    }
+}
+
+static const char * JournalDirectory = "tests";
+static const char * JournalPrefix = "tj";
+
+static string getJournalFileName(const char * name)
+{
+    return string(JournalDirectory) + "/" + JournalPrefix + name;
+}
+
+static void removeJournal()
+{
+    remove(getJournalFileName("commt0.jnl").c_str());
+    remove(getJournalFileName("commt1.jnl").c_str());
+    for(int i = 0; i < 16; i++)
+    {
+        char name[20];
+        sprintf(name, "%06d.jnl", i);
+        remove(getJournalFileName(name).c_str());
+    }
+}
+
+static void truncateFile(const string & fileName, size_t removeCount)
+{
+    string contents;
+    {
+        ifstream is(fileName.c_str(), ios::in | ios::binary);
+        contents.assign((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    }
+    ofstream os(fileName.c_str(), ios::out | ios::binary | ios::trunc);
+    os.write(contents.data(), contents.size() - removeCount);
+}
+
+typedef EventRing<16> SmallRing;
+
+static void addEvent(EventJournal & journal, SmallRing & ring, uint32_t time)
+{
+    EventRecord record = {time, (uint8_t)(time & 1), 0, 0};
+    journal.add(ring, record);
+}
+
+// sends batches of up to 8 records as sendEvents would, until the ring is empty or batchCount runs out
+static void sendAll(EventJournal & journal, SmallRing & ring, vector<EventRecord> & sent, size_t batchCount = 1000)
+{
+    for(size_t batch = 0; batch < batchCount && !ring.empty(); batch++)
+    {
+        size_t count = ring.size() < 8 ? ring.size() : 8;
+        for(size_t i = 0; i < count; i++)
+            sent.push_back(ring[i]);
+        journal.acknowledge(ring, ring.getStartSequence() + count);
+        if(batch % 3 == 0)
+            journal.flush(ring);
+    }
+}
+
+static void testJournal()
+{
+    removeJournal();
+    {
+        // more records than the ring holds come back out in order, none dropped
+        SmallRing ring;
+        EventJournal journal(JournalDirectory, JournalPrefix);
+        journal.replay(ring);
+        CHECK(ring.empty());
+        for(uint32_t time = 0; time < 100; time++)
+        {
+            addEvent(journal, ring, time);
+            if(time % 20 == 19)
+                CHECK(journal.flush(ring));
+        }
+        CHECK(ring.full());
+        CHECK(journal.getUnwrittenCount(ring) == 0);
+        vector<EventRecord> sent;
+        sendAll(journal, ring, sent, 3);
+        CHECK(journal.flush(ring));
+        for(uint32_t time = 100; time < 110; time++)
+            addEvent(journal, ring, time); // not flushed, so lost in the reset
+    }
+    {
+        // a reset : everything from the last acknowledgement flushed is there, the ring refills
+        SmallRing ring;
+        EventJournal journal(JournalDirectory, JournalPrefix);
+        journal.replay(ring);
+        CHECK(ring.getStartSequence() == 24);
+        CHECK(ring.full() && ring[0].time == 24);
+        vector<EventRecord> sent;
+        sendAll(journal, ring, sent);
+        CHECK(sent.size() == 76);
+        for(size_t i = 0; i < sent.size(); i++)
+            CHECK(sent[i].time == 24 + i && sent[i].flags == 0);
+        CHECK(ring.getDroppedCount() == 0);
+        CHECK(journal.flush(ring));
+        CHECK(ring.empty() && ring.getStartSequence() == 100);
+    }
+    removeJournal();
+    {
+        SmallRing ring;
+        EventJournal journal(JournalDirectory, JournalPrefix);
+        journal.replay(ring);
+        for(uint32_t time = 0; time < 600; time++)
+        {
+            addEvent(journal, ring, time);
+            if(time % 20 == 19)
+                CHECK(journal.flush(ring));
+        }
+    }
+    // tear the last batch of the first segment, so there's a gap in the middle of the journal
+    truncateFile(getJournalFileName("000000.jnl"), 3);
+    {
+        SmallRing ring;
+        EventJournal journal(JournalDirectory, JournalPrefix);
+        journal.replay(ring);
+        vector<EventRecord> sent;
+        sendAll(journal, ring, sent);
+        CHECK(sent.size() == 580 && sent.front().time == 0 && sent.back().time == 599);
+        size_t gapCount = 0;
+        for(size_t i = 1; i < sent.size(); i++)
+        {
+            if(sent[i].flags & EventAfterGap)
+            {
+                gapCount++;
+                CHECK(sent[i].time == sent[i - 1].time + 21);
+            }
+            else
+                CHECK(sent[i].time == sent[i - 1].time + 1);
+        }
+        CHECK(gapCount == 1);
+    }
+    removeJournal();
+    {
+        // nowhere to write : the ring, then the records waiting for room, then they're dropped
+        SmallRing ring;
+        EventJournal journal("tests/missing", JournalPrefix);
+        journal.replay(ring);
+        const size_t pendingCount = EventJournal::PendingBytes / sizeof(EventRecord);
+        for(uint32_t time = 0; time < 100; time++)
+            addEvent(journal, ring, time);
+        CHECK(!journal.flush(ring));
+        CHECK(ring.getDroppedCount() == 100 - ring.capacity() - pendingCount);
+        vector<EventRecord> sent;
+        sendAll(journal, ring, sent, 2); // makes room for the next one
+        addEvent(journal, ring, 1000);
+        sendAll(journal, ring, sent);
+        CHECK(sent.size() == ring.capacity() + pendingCount + 1);
+        for(size_t i = 0; i + 1 < sent.size(); i++)
+            CHECK(sent[i].time == i && sent[i].flags == 0);
+        CHECK(sent.back().time == 1000 && sent.back().flags == EventAfterGap);
+    }
+    {
+        // closed buckets through the count journal, with the occupancy back after a reset
+        CrossingAggregator crossings;
+        EventJournal journal(JournalDirectory, JournalPrefix);
+        journal.replay(crossings.getBuckets());
+        crossings.setJournal(&journal);
+        for(uint32_t i = 0; i < 300; i++)
+            crossings.add(i % 3 ? EventIn : EventOut, 1000 + i * 30);
+        crossings.closeBefore(100000);
+        CrossingAggregator::BucketRing & buckets = crossings.getBuckets();
+        CHECK(buckets.full() && buckets.getDroppedCount() == 0);
+        journal.acknowledge(buckets, buckets.getStartSequence() + 10);
+        CHECK(journal.flush(buckets));
+
+        CrossingAggregator restored;
+        EventJournal restoredJournal(JournalDirectory, JournalPrefix);
+        CountBucket lastBucket;
+        lastBucket.occupancy = 0;
+        restoredJournal.replay(restored.getBuckets(), &lastBucket);
+        CHECK(lastBucket.occupancy == crossings.getOccupancy());
+        CHECK(restored.getBuckets()[0].startTime == buckets[0].startTime);
+        size_t count = 0;
+        for(uint32_t previousStart = 0; !restored.getBuckets().empty(); count++)
+        {
+            CHECK(restored.getBuckets()[0].startTime > previousStart);
+            previousStart = restored.getBuckets()[0].startTime;
+            restoredJournal.acknowledge(restored.getBuckets(), restored.getBuckets().getStartSequence() + 1);
+        }
+        CHECK(count == 141);
+    }
+    removeJournal();
+}
+
+static void checkDecodedBatch(const DecodedBatch & batch, uint32_t time, const EventRing<32> & events, size_t eventCount,
+                              const CrossingAggregator::BucketRing & buckets, size_t bucketCount)
+{
+    CHECK(batch.time == time);
+    CHECK(batch.droppedEvents == events.getDroppedCount() && batch.droppedBuckets == buckets.getDroppedCount());
+    CHECK(batch.events.size() == eventCount && batch.buckets.size() == bucketCount);
+    for(size_t i = 0; i < batch.events.size() && i < eventCount; i++)
+    {
+        CHECK(batch.events[i].time == events[i].time && batch.events[i].direction == events[i].direction);
+        CHECK((batch.events[i].flags & EventAfterGap) == (events[i].flags & EventAfterGap));
+    }
+    for(size_t i = 0; i < batch.buckets.size() && i < bucketCount; i++)
+    {
+        const CountBucket & decoded = batch.buckets[i];
+        CHECK(decoded.startTime == buckets[i].startTime && decoded.width == buckets[i].width);
+        CHECK(decoded.inCount == buckets[i].inCount && decoded.outCount == buckets[i].outCount);
+        CHECK(decoded.occupancy == buckets[i].occupancy);
+    }
+}
+
+static void testBatchRoundTrip()
+{
+    EventRing<32> events; // small, so it drops some
+    CrossingAggregator crossings;
+    uint32_t time = 0x65000000;
+    for(uint32_t i = 0; i < 40; i++)
+    {
+        time += (i * 37) % 90;
+        EventRecord record = {time, (uint8_t)((i * 5) % 3 == 0 ? EventOut : EventIn), 0, 0};
+        events.push(record);
+        crossings.add((EventDirection)record.direction, time);
+    }
+    uint32_t now = time + 5;
+    crossings.closeBefore(now + 60);
+    const CrossingAggregator::BucketRing & buckets = crossings.getBuckets();
+    CHECK(events.getDroppedCount() == 8 && (events[0].flags & EventAfterGap));
+    string binary;
+    appendBinaryBatch(binary, now, events, 30, buckets, buckets.size());
+    DecodedBatch batch;
+    CHECK(decodeBatch("door1\n" + binary, 6, batch));
+    checkDecodedBatch(batch, now, events, 30, buckets, buckets.size());
+
+    string framed(1, Base64BatchMarker);
+    appendBase64Bytes(framed, (const uint8_t *)binary.data(), binary.size());
+    framed += "\n";
+    DecodedBatch framedBatch;
+    CHECK(decodeBatch(framed, 0, framedBatch));
+    checkDecodedBatch(framedBatch, now, events, 30, buckets, buckets.size());
+
+    string text;
+    appendTextBatch(text, batch);
+    CHECK(text.find(" 8 0\n") != string::npos && text.find(" gap\n") != string::npos);
+    for(size_t size = 1; size < binary.size(); size++)
+    {
+        DecodedBatch cut;
+        CHECK(!decodeBatch(binary.substr(0, size), 0, cut));
+    }
+}
+
+int main()
+{
+    testChaCha20Block();
+    testPoly1305();
+    testChaCha20Poly1305();
+    testPayloadRoundTrip();
+    testJournal();
+    testBatchRoundTrip();
+    if(failureCount > 0)
+    {
+        cout << failureCount << " checks failed" << endl;
+        return 1;
+    }
+    cout << "all passed" << endl;
+    return 0;
+}
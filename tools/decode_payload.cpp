@@ -0,0 +1,50 @@
+// the collector's decoder : make decode-payload && ./tools/decode_payload key.txt < payload
+// key.txt holds the modulus and then the private exponent as hex byte strings, like /local/enc-key.txt.
+// Prints the text of a payload of any version, or fails if it doesn't check out.
+// Binary and base64 batches (see batch.h) are printed as the text batch lines they stand for.
+#include "payload.h"
+#include "batch.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    if(argc != 2)
+    {
+        cerr << "usage : " << argv[0] << " key.txt < payload" << endl;
+        return 1;
+    }
+    ifstream is(argv[1]);
+    string modulusString, exponentString;
+    if(!(is >> modulusString >> exponentString))
+    {
+        cerr << "can't read the key from " << argv[1] << endl;
+        return 1;
+    }
+    RSAPrivateKey key(BigUnsigned::parseHexByteString(modulusString), BigUnsigned::parseHexByteString(exponentString));
+    string payload((istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+    string text;
+    if(!decryptPayload(payload, key, text))
+    {
+        cerr << "payload doesn't decrypt with this key" << endl;
+        return 1;
+    }
+    size_t batchStart = text.find('\n') + 1; // after the device name
+    if(batchStart > 0 && batchStart < text.size() && ((uint8_t)text[batchStart] == BinaryBatchVersion || text[batchStart] == Base64BatchMarker))
+    {
+        DecodedBatch batch;
+        if(!decodeBatch(text, batchStart, batch))
+        {
+            cerr << "malformed batch" << endl;
+            return 1;
+        }
+        string decoded = text.substr(0, batchStart);
+        appendTextBatch(decoded, batch);
+        text.swap(decoded);
+    }
+    cout << text;
+    return 0;
+}